@@ -0,0 +1,190 @@
+#include "apic.h"
+#include "i8259.h"
+#include "lib.h"
+#include "tlb.h"
+#include "driver/pit.h"
+#include "interrupt/vectors.h"
+#include "irqoff.h"
+
+#define CPUID_APIC 0x200
+#define APIC_PAGE_FLAGS 0x19B  /* Present, R/W, write through, uncached, 4MB, global */
+#define SVR_ENABLE 0x100
+#define LVT_MASKED 0x10000
+#define LVT_PERIODIC 0x20000
+#define TIMER_DIVIDE_16 0x3
+
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_REDIR 0x10  /* Two registers per pin */
+#define REDIR_MASKED 0x10000
+
+#define PIC_MASTER_DATA 0x21
+#define PIC_SLAVE_DATA 0xA1
+#define PIC_CASCADE_IRQ 2
+
+#define CALIBRATE_US 10000
+#define CALIBRATE_HZ (1000000 / CALIBRATE_US)
+#define ICR_PENDING 0x1000
+
+extern uint32_t pgDir[];
+
+uint8_t apic_active = 0;
+uint32_t lapic_timer_hz = 0;
+static uint32_t bsp_apic_id;
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(IOAPIC_BASE + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(IOAPIC_BASE + IOAPIC_WINDOW) = value;
+}
+
+/* ISA IRQs map 1:1 onto I/O APIC pins, except the PIT which QEMU and
+ * most boards wire to pin 2 (the MADT override we don't parse) */
+static uint32_t ioapic_pin(uint32_t irq) {
+    return irq ? irq : 2;
+}
+
+/* Points a pin at the BSP, edge triggered, active high */
+static void ioapic_route(uint32_t irq, uint8_t masked) {
+    uint32_t pin = ioapic_pin(irq);
+    ioapic_write(IOAPIC_REDIR + 2 * pin + 1, bsp_apic_id << 24);
+    ioapic_write(IOAPIC_REDIR + 2 * pin,
+                 (VEC_TIMER + irq) | (masked ? REDIR_MASKED : 0));
+}
+
+static int32_t apic_present() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & CPUID_APIC) != 0;
+}
+
+/* Counts LAPIC timer ticks across 10ms of PIT channel 2 */
+static uint32_t lapic_calibrate() {
+    uint32_t count;
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    pit_delay_us(CALIBRATE_US);
+    count = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    return count * CALIBRATE_HZ;
+}
+
+/**
+ * Software enables this CPU's LAPIC, with the 8259's LINT0 masked.
+ * INPUT: None
+ * OUTPUT: None
+ */
+void lapic_init_cpu() {
+    lapic_write(LAPIC_SVR, SVR_ENABLE | VEC_SPURIOUS);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);
+}
+
+/**
+ * Periodic tick from this CPU's LAPIC timer.
+ * INPUT: vector: Where the ticks arrive
+ * OUTPUT: None
+ * EFFECT: Uses the BSP's calibration, every LAPIC runs off the same bus
+ *         clock.
+ */
+void lapic_timer_start(uint32_t vector) {
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, vector | LVT_PERIODIC);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_hz / PIT_TICK_RATE);
+}
+
+/**
+ * Sends an inter-processor interrupt and waits until the LAPIC took it.
+ * INPUT: apic_id: Target LAPIC, icr_low: Vector and delivery mode
+ * OUTPUT: None
+ */
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr_low) {
+    uint32_t flags;
+    irqoff_save(flags);
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr_low);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING);
+    irqoff_restore(flags);
+}
+
+/**
+ * Moves interrupt delivery to the APICs.
+ * INPUT: None
+ * OUTPUT: 0 on success, -1 if there is no APIC or it's compiled out
+ * EFFECT: The LAPIC timer takes over the scheduler tick at PIT_TICK_RATE
+ *         on the timer vector. LINT0 is masked, so nothing the 8259 still
+ *         raises gets through.
+ */
+int32_t apic_init() {
+    uint32_t flags, irq, unmasked, old_svr, old_lint0;
+    if (!APIC_ENABLE || apic_active || !apic_present()) return -1;
+    irqoff_save(flags);
+    pgDir[APIC_PDE_INDEX] = IOAPIC_BASE | APIC_PAGE_FLAGS;
+    invlpg(LAPIC_BASE);
+
+    old_svr = lapic_read(LAPIC_SVR);
+    old_lint0 = lapic_read(LAPIC_LVT_LINT0);
+    lapic_init_cpu();
+    bsp_apic_id = lapic_read(LAPIC_ID) >> 24;
+
+    lapic_timer_hz = lapic_calibrate();
+    if (lapic_timer_hz < PIT_TICK_RATE) {
+        // Too slow to keep the tick rate, leave everything on the 8259
+        lapic_write(LAPIC_LVT_LINT0, old_lint0);
+        lapic_write(LAPIC_SVR, old_svr);
+        irqoff_restore(flags);
+        return -1;
+    }
+
+    // Carry over what was enabled on the 8259, then cut it off
+    unmasked = ~(inb(PIC_MASTER_DATA) | (inb(PIC_SLAVE_DATA) << 8));
+    for (irq = 1; irq < APIC_NUM_ISA_IRQS; irq++) {
+        if (irq == PIC_CASCADE_IRQ) continue;
+        ioapic_route(irq, !(unmasked & (1 << irq)));
+    }
+    ioapic_route(PIT_IRQNUM, 1);
+    outb(0xFF, PIC_MASTER_DATA);
+    outb(0xFF, PIC_SLAVE_DATA);
+
+    lapic_timer_start(VEC_TIMER);
+    apic_active = 1;
+    irqoff_restore(flags);
+    return 0;
+}
+
+/**
+ * Unmasks an ISA IRQ on whichever controller is in use.
+ * INPUT: irq: 0-15
+ * OUTPUT: None
+ */
+void irq_enable(uint32_t irq) {
+    if (!apic_active) {
+        enable_irq(irq);
+        return;
+    }
+    // The LAPIC timer stands in for the PIT
+    if (irq != PIT_IRQNUM && irq < APIC_NUM_ISA_IRQS) ioapic_route(irq, 0);
+}
+
+/**
+ * Masks an ISA IRQ on whichever controller is in use.
+ * INPUT: irq: 0-15
+ * OUTPUT: None
+ */
+void irq_disable(uint32_t irq) {
+    if (!apic_active) {
+        disable_irq(irq);
+        return;
+    }
+    if (irq < APIC_NUM_ISA_IRQS) ioapic_route(irq, 1);
+}
+
+/**
+ * Acknowledges an interrupt.
+ * INPUT: irq: The line being serviced
+ * OUTPUT: None
+ */
+void irq_eoi(uint32_t irq) {
+    if (apic_active) lapic_eoi();
+    else send_eoi(irq);
+}
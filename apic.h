@@ -0,0 +1,82 @@
+/* apic.h - Local APIC and I/O APIC, with the 8259 as the fallback
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+/* Build with -DAPIC_ENABLE=0 to stay on the 8259 */
+#ifndef APIC_ENABLE
+#define APIC_ENABLE 1
+#endif
+
+/* Both controllers sit in the same 4MB page, mapped uncached 1:1 */
+#define LAPIC_BASE 0xFEE00000
+#define IOAPIC_BASE 0xFEC00000
+#define APIC_PDE_INDEX (IOAPIC_BASE >> 22)
+
+/* Local APIC registers, offsets from LAPIC_BASE */
+#define LAPIC_ID 0x20
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define APIC_NUM_ISA_IRQS 16
+
+#ifndef ASM
+
+/* 1 once interrupts are delivered by the I/O APIC and the tick comes
+ * from the LAPIC timer */
+extern uint8_t apic_active;
+/* LAPIC timer counts per second, after dividing by 16 */
+extern uint32_t lapic_timer_hz;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(LAPIC_BASE + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(LAPIC_BASE + reg) = value;
+}
+
+/* A single store, no port I/O */
+static inline void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* ICR delivery modes */
+#define ICR_FIXED 0x0000
+#define ICR_INIT 0x4500  /* Level assert */
+#define ICR_STARTUP 0x4600  /* Vector field is the start page */
+
+/* Enables the LAPIC of the calling CPU, for the BSP and each AP */
+void lapic_init_cpu(void);
+
+/* Starts this CPU's LAPIC timer at PIT_TICK_RATE on vector */
+void lapic_timer_start(uint32_t vector);
+
+/* Sends an IPI to one LAPIC */
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr_low);
+
+/* Switches from the 8259 to the APICs. Lines already unmasked on the 8259
+ * are carried over. Returns 0 on success, -1 if staying on the 8259. */
+int32_t apic_init(void);
+
+/* Controller independent versions of enable_irq/disable_irq/send_eoi */
+void irq_enable(uint32_t irq);
+void irq_disable(uint32_t irq);
+void irq_eoi(uint32_t irq);
+
+#endif /* ASM */
+
+#endif /* _APIC_H */
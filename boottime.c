@@ -0,0 +1,61 @@
+#include "boottime.h"
+#include "lib.h"
+#include "tsc.h"
+#include "driver/serial.h"
+
+#define BOOT_NAME_WIDTH 20  /* Name plus right aligned count */
+
+uint64_t boot_tsc_start = 0;
+
+static const int8_t* phase_name[BOOT_MAX_PHASES];
+static uint64_t phase_end[BOOT_MAX_PHASES];
+static uint32_t num_phases = 0;
+static uint8_t boot_done = 0;
+
+void boot_phase(const int8_t* name) {
+    if (boot_done || num_phases >= BOOT_MAX_PHASES) return;
+    phase_name[num_phases] = name;
+    phase_end[num_phases] = rdtsc();
+    num_phases++;
+}
+
+/* Cycles between two stamps, in units of 1024 cycles */
+static uint32_t boot_kcycles(uint64_t from, uint64_t to) {
+    return (uint32_t)((to - from) >> BOOT_KCYCLE_SHIFT);
+}
+
+void boot_info(procfs_out_t* out) {
+    uint32_t i;
+    uint64_t prev = boot_tsc_start;
+    uint32_t len;
+    procfs_puts(out, "phase         kcycles\n");
+    for (i = 0; i < num_phases; i++) {
+        len = strlen(phase_name[i]);
+        procfs_puts(out, phase_name[i]);
+        procfs_puts(out, " ");
+        procfs_putu(out, boot_kcycles(prev, phase_end[i]),
+                    len < BOOT_NAME_WIDTH ? BOOT_NAME_WIDTH - len : 0);
+        procfs_puts(out, "\n");
+        prev = phase_end[i];
+    }
+    procfs_puts(out, "total ");
+    procfs_putu(out, num_phases ?
+                boot_kcycles(boot_tsc_start, phase_end[num_phases - 1]) : 0,
+                BOOT_NAME_WIDTH - 5);
+    procfs_puts(out, "\n");
+}
+
+void boot_finish(void) {
+    int8_t text[PROCFS_BUF_SIZE / 4];
+    procfs_out_t out;
+    if (boot_done) return;
+    boot_phase("shell");
+    boot_done = 1;
+    out.buf = text;
+    out.len = 0;
+    out.size = sizeof(text) - 1;
+    boot_info(&out);
+    text[out.len] = 0;
+    printf("%s", text);
+    serial_puts(text);
+}
@@ -0,0 +1,33 @@
+/* boottime.h - TSC timestamps of the boot phases
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BOOTTIME_H
+#define _BOOTTIME_H
+
+#include "types.h"
+#include "driver/procfs.h"
+
+#define BOOT_MAX_PHASES 16
+/* Phases are reported in units of 1024 cycles, which keeps the whole boot
+ * in 32 bits without a 64 bit divide */
+#define BOOT_KCYCLE_SHIFT 10
+
+#ifndef ASM
+
+/* Written by boot.S before anything else runs */
+extern uint64_t boot_tsc_start;
+
+/* Marks the end of a boot phase. Each phase is charged the time since the
+ * previous mark, so untimed work in between lands in the next phase. */
+void boot_phase(const int8_t* name);
+
+/* Marks the first shell as started and prints the phase table, once */
+void boot_finish(void);
+
+/* proc/boot */
+void boot_info(procfs_out_t* out);
+
+#endif /* ASM */
+
+#endif /* _BOOTTIME_H */
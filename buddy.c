@@ -0,0 +1,201 @@
+#include "buddy.h"
+#include "lib.h"
+#include "multiboot.h"
+#include "driver/procfs.h"
+#include "irqoff.h"
+
+#define BUDDY_NIL 0xFFFF
+#define BUDDY_FREE 0x80  /* Set in block_order[] on the first frame of a free block */
+#define MMAP_AVAILABLE 1
+
+/* Saved by boot.S before anything else runs */
+uint32_t multiboot_info_addr = 0;
+
+boot_module_t boot_modules[BUDDY_MAX_MODULES];
+uint32_t boot_num_modules = 0;
+
+/* The frames themselves aren't mapped in the kernel, so all bookkeeping
+ * lives here: free lists are doubly linked through frame numbers. */
+static uint16_t free_next[BUDDY_MAX_FRAMES];
+static uint16_t free_prev[BUDDY_MAX_FRAMES];
+static uint8_t block_order[BUDDY_MAX_FRAMES];
+static uint16_t free_head[BUDDY_MAX_ORDER + 1];
+static uint32_t free_blocks[BUDDY_MAX_ORDER + 1];
+static uint32_t num_free = 0;
+static uint32_t num_total = 0;
+static uint8_t buddy_ready = 0;
+
+static void list_push(uint32_t frame, uint32_t order) {
+    free_prev[frame] = BUDDY_NIL;
+    free_next[frame] = free_head[order];
+    if (free_head[order] != BUDDY_NIL) free_prev[free_head[order]] = frame;
+    free_head[order] = frame;
+    block_order[frame] = order | BUDDY_FREE;
+    free_blocks[order]++;
+}
+
+static void list_remove(uint32_t frame, uint32_t order) {
+    if (free_prev[frame] != BUDDY_NIL) free_next[free_prev[frame]] = free_next[frame];
+    else free_head[order] = free_next[frame];
+    if (free_next[frame] != BUDDY_NIL) free_prev[free_next[frame]] = free_prev[frame];
+    block_order[frame] = 0;
+    free_blocks[order]--;
+}
+
+/* Frees a block, merging with its buddy as long as the buddy is free too */
+static void buddy_release(uint32_t frame, uint32_t order) {
+    uint32_t buddy;
+    num_free += 1 << order;
+    while (order < BUDDY_MAX_ORDER) {
+        buddy = frame ^ (1 << order);
+        if (buddy >= BUDDY_MAX_FRAMES || block_order[buddy] != (order | BUDDY_FREE))
+            break;
+        list_remove(buddy, order);
+        frame &= ~(1 << order);
+        order++;
+    }
+    list_push(frame, order);
+}
+
+/* Returns 1 if [start, end) overlaps a boot module */
+static int32_t overlaps_module(uint32_t start, uint32_t end) {
+    uint32_t i;
+    for (i = 0; i < boot_num_modules; i++) {
+        if (start < boot_modules[i].end && boot_modules[i].start < end) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Puts every usable frame on the free lists.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: Uses the multiboot memory map when GRUB gave us one, mem_upper
+ *         otherwise. The kernel area and boot modules are never handed out.
+ *         Runs from boot.S with paging still off, everything needed from
+ *         the multiboot info later is copied out here.
+ */
+void buddy_init() {
+    multiboot_info_t* mbi = (multiboot_info_t*)multiboot_info_addr;
+    memory_map_t* mmap;
+    module_t* mod;
+    uint32_t i, addr, start, end;
+
+    for (i = 0; i < BUDDY_MAX_FRAMES; i++) block_order[i] = 0;
+    for (i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        free_head[i] = BUDDY_NIL;
+        free_blocks[i] = 0;
+    }
+    buddy_ready = 1;
+    if (!mbi) return;
+
+    if (mbi->flags & (1 << 3)) {
+        mod = (module_t*)mbi->mods_addr;
+        for (i = 0; i < mbi->mods_count && i < BUDDY_MAX_MODULES; i++, mod++) {
+            boot_modules[i].start = mod->mod_start;
+            boot_modules[i].end = mod->mod_end;
+        }
+        boot_num_modules = i;
+    }
+
+    for (mmap = (memory_map_t*)mbi->mmap_addr;
+         (mbi->flags & (1 << 6)) &&
+         (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+         mmap = (memory_map_t*)((uint32_t)mmap + mmap->size + sizeof(mmap->size))) {
+        if (mmap->type != MMAP_AVAILABLE || mmap->base_addr_high) continue;
+        start = (mmap->base_addr_low + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+        end = mmap->base_addr_low + mmap->length_low;
+        if (mmap->length_high || end < mmap->base_addr_low) end = 0xFFFFFFFF;
+        if (start < BUDDY_RESERVED_TOP) start = BUDDY_RESERVED_TOP;
+        if (end > BUDDY_MAX_MEMORY) end = BUDDY_MAX_MEMORY;
+        for (addr = start; addr + FRAME_SIZE <= end; addr += FRAME_SIZE) {
+            if (overlaps_module(addr, addr + FRAME_SIZE)) continue;
+            buddy_release(addr >> FRAME_SHIFT, 0);
+            num_total++;
+        }
+    }
+    // No memory map: trust mem_upper (kB above 1MB)
+    if (!num_total && (mbi->flags & 1)) {
+        end = 0x100000 + mbi->mem_upper * 1024;
+        if (end > BUDDY_MAX_MEMORY) end = BUDDY_MAX_MEMORY;
+        for (addr = BUDDY_RESERVED_TOP; addr + FRAME_SIZE <= end; addr += FRAME_SIZE) {
+            if (overlaps_module(addr, addr + FRAME_SIZE)) continue;
+            buddy_release(addr >> FRAME_SHIFT, 0);
+            num_total++;
+        }
+    }
+}
+
+/**
+ * Allocates a block of frames.
+ * INPUT: order: log2 of the number of frames
+ * OUTPUT: Physical address of the block, 0 when nothing big enough is free
+ */
+uint32_t frame_alloc(uint32_t order) {
+    uint32_t k, frame, flags;
+    if (order > BUDDY_MAX_ORDER) return 0;
+    irqoff_save(flags);
+    if (!buddy_ready) {
+        irqoff_restore(flags);
+        return 0;
+    }
+    for (k = order; k <= BUDDY_MAX_ORDER && free_head[k] == BUDDY_NIL; k++);
+    if (k > BUDDY_MAX_ORDER) {
+        irqoff_restore(flags);
+        return 0;
+    }
+    frame = free_head[k];
+    list_remove(frame, k);
+    // Split, giving the upper halves back
+    while (k > order) {
+        k--;
+        list_push(frame + (1 << k), k);
+    }
+    num_free -= 1 << order;
+    irqoff_restore(flags);
+    return frame << FRAME_SHIFT;
+}
+
+/**
+ * Frees a block of frames.
+ * INPUT: addr: Address from frame_alloc, 0 is ignored
+ *        order: Same order it was allocated with
+ * OUTPUT: None
+ */
+void frame_free(uint32_t addr, uint32_t order) {
+    uint32_t flags;
+    if (!addr) return;
+    irqoff_save(flags);
+    buddy_release(addr >> FRAME_SHIFT, order);
+    irqoff_restore(flags);
+}
+
+uint32_t frame_order(uint32_t num_frames) {
+    uint32_t order = 0;
+    while ((1U << order) < num_frames) order++;
+    return order;
+}
+
+uint32_t frames_free() {
+    return num_free;
+}
+
+uint32_t frames_total() {
+    return num_total;
+}
+
+/* proc/buddyinfo: free blocks per order */
+void buddy_info(procfs_out_t* out) {
+    uint32_t order;
+    procfs_puts(out, "frames free ");
+    procfs_putu(out, num_free, 0);
+    procfs_puts(out, " of ");
+    procfs_putu(out, num_total, 0);
+    procfs_puts(out, "\norder");
+    for (order = 0; order <= BUDDY_MAX_ORDER; order++)
+        procfs_putu(out, order, 6);
+    procfs_puts(out, "\nfree ");
+    for (order = 0; order <= BUDDY_MAX_ORDER; order++)
+        procfs_putu(out, free_blocks[order], 6);
+    procfs_puts(out, "\n");
+}
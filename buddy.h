@@ -0,0 +1,59 @@
+/* buddy.h - Buddy allocator for physical page frames
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include "types.h"
+#include "driver/procfs.h"
+
+#define FRAME_SIZE 0x1000
+#define FRAME_SHIFT 12
+#define BUDDY_MAX_ORDER 10  /* 2^10 frames: one 4MB page */
+#define BUDDY_ORDER_4MB BUDDY_MAX_ORDER
+
+/* Memory below this belongs to the kernel image and video memory */
+#define BUDDY_RESERVED_TOP 0x800000
+/* Frames above this aren't tracked, keeps the bookkeeping arrays small */
+#define BUDDY_MAX_MEMORY 0x8000000  /* 128MB */
+#define BUDDY_MAX_FRAMES (BUDDY_MAX_MEMORY >> FRAME_SHIFT)
+#define BUDDY_MAX_MODULES 8  /* Boot modules kept track of */
+
+#ifndef ASM
+
+/* Physical range of a boot module, [start, end) */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} boot_module_t;
+
+/* Multiboot info pointer, saved by boot.S */
+extern uint32_t multiboot_info_addr;
+
+/* Module ranges, copied out of the multiboot info by buddy_init */
+extern boot_module_t boot_modules[BUDDY_MAX_MODULES];
+extern uint32_t boot_num_modules;
+
+/* Builds the free lists from the multiboot memory map. Called by boot.S
+ * before paging is on, since the multiboot structures sit in low memory
+ * that the kernel doesn't map. */
+void buddy_init(void);
+
+/* Allocates 2^order physically contiguous, naturally aligned frames.
+ * Returns the physical address, 0 when out of memory. */
+uint32_t frame_alloc(uint32_t order);
+void frame_free(uint32_t addr, uint32_t order);
+
+/* Smallest order holding num_frames frames */
+uint32_t frame_order(uint32_t num_frames);
+
+uint32_t frames_free(void);
+uint32_t frames_total(void);
+
+/* proc/buddyinfo generator */
+void buddy_info(procfs_out_t* out);
+
+#endif /* ASM */
+
+#endif /* _BUDDY_H */
@@ -1,6 +1,7 @@
 #include "keyboard.h"
-#include "../i8259.h"
+#include "../apic.h"
 #include "../lib.h"
+#include "../interrupt/irq.h"
 
 #define KEY_CTRL 29
 #define KEY_SHIFT_L 42
@@ -96,18 +97,16 @@ unsigned char scancode_keymap_caps[128] = {
  * Return Value: none
  * Function: initialize the keyboard device */
 void keyboard_init(void) {
-  enable_irq(KB_IRQNUM);
+  request_irq(KB_IRQNUM, handle_keyboard, "keyboard", NULL, 0);
   return;
 }
 
-/* uint8_t get_keyboard_input (void)
- * Inputs: none
- * Return Value: one byte scancode read from keyboard
- * Function: read in a 8bit scancode from the keyboard, used
- *           in keyboard interrupt handler.*/
-uint8_t get_keyboard_input(void) {
-  uint8_t data;
-  data = inb(KB_PORT); // get key press scan code
+/* uint8_t keyboard_translate (uint8_t data)
+ * Inputs: data -- scancode the keyboard interrupt read from KB_PORT
+ * Return Value: key for terminal_handle_key, 0 for releases
+ * Function: tracks the modifier keys and maps a scancode to a key, used
+ *           in the keyboard bottom half.*/
+uint8_t keyboard_translate(uint8_t data) {
   if (data & KEY_UP) {
     // Handle release key
     data &= ~KEY_UP;
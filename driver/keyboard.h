@@ -29,8 +29,8 @@ extern volatile char caps_down;
 /* function to initialize the RTC */
 void keyboard_init(void);
 
-/* function to read in scancode from keyboard */
-uint8_t get_keyboard_input(void);
+/* function to turn a scancode read from keyboard into a key */
+uint8_t keyboard_translate(uint8_t data);
 
 // END  CP1.4
 
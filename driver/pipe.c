@@ -0,0 +1,208 @@
+#include "pipe.h"
+#include "../lib.h"
+#include "../interrupt/process.h"
+#include "../interrupt/sched.h"
+#include "../irqoff.h"
+#include "../uaccess.h"
+
+/* Compiler barrier. x86 doesn't reorder stores with other stores, so making
+ * sure the compiler emits the ring copy before the index update is all the
+ * ordering a single producer and single consumer need. */
+#define pipe_barrier() asm volatile("" : : : "memory")
+
+static pipe_t pipes[NUM_PIPES];
+
+/* pipe_create
+ * Inputs: none
+ * Return Value: index of the new pipe, -1 if all pipes are taken
+ * Function: reserves an empty pipe with one open end on each side */
+int32_t pipe_create(void) {
+  int32_t i;
+  irqoff_cli();
+  for (i = 0; i < NUM_PIPES; i++) {
+    if (!pipes[i].in_use) {
+      pipes[i].in_use = 1;
+      pipes[i].readers = 1;
+      pipes[i].writers = 1;
+      pipes[i].head = 0;
+      pipes[i].tail = 0;
+      irqoff_sti();
+      return i;
+    }
+  }
+  irqoff_sti();
+  return -1;
+}
+
+/* Bytes from position pos up to the end of its ring page. The ring is a
+ * whole number of pages, so that never crosses the wrap point. */
+static uint32_t pipe_page_left(uint32_t pos) {
+  return PIPE_PAGE_SIZE - (pos & (PIPE_PAGE_SIZE - 1));
+}
+
+/* pipe_push
+ * Inputs: index -- pipe to write into
+ *         buf -- bytes to write
+ *         nbytes -- number of bytes in buf
+ * Return Value: number of bytes actually queued, may be less than nbytes,
+ *               -1 if buf faulted before anything was queued
+ * Function: producer side of the ring. Copies up to one ring page at a
+ * time and publishes each piece, so the reader can start draining a large
+ * transfer before the writer is done. Where the head stands doesn't
+ * matter, a piece just ends at the next page boundary. */
+int32_t pipe_push(uint32_t index, const uint8_t *buf, int32_t nbytes) {
+  pipe_t *p = &pipes[index];
+  uint32_t head = p->head;
+  uint32_t space = PIPE_RING_SIZE - (head - p->tail);
+  uint32_t n;
+  int32_t done = 0;
+
+  while (done < nbytes && space) {
+    n = pipe_page_left(head);
+    if (n > (uint32_t)(nbytes - done)) n = nbytes - done;
+    if (n > space) n = space;
+    if (__copy_user(&p->ring[head & PIPE_RING_MASK], buf + done, n))
+      return done ? done : -1;  // Nothing of this piece is published
+    head += n;
+    space -= n;
+    done += n;
+    pipe_barrier();
+    p->head = head;
+  }
+  return done;
+}
+
+/* pipe_pull
+ * Inputs: index -- pipe to read from
+ *         buf -- destination buffer
+ *         nbytes -- size of buf
+ * Return Value: number of bytes actually consumed, may be less than nbytes,
+ *               -1 if buf faulted before anything was consumed
+ * Function: consumer side of the ring, mirror image of pipe_push. Space is
+ * handed back to the writer a ring page at a time, a faulting piece stays
+ * in the ring. */
+int32_t pipe_pull(uint32_t index, uint8_t *buf, int32_t nbytes) {
+  pipe_t *p = &pipes[index];
+  uint32_t tail = p->tail;
+  uint32_t avail = p->head - tail;
+  uint32_t n;
+  int32_t done = 0;
+
+  pipe_barrier();
+  while (done < nbytes && avail) {
+    n = pipe_page_left(tail);
+    if (n > (uint32_t)(nbytes - done)) n = nbytes - done;
+    if (n > avail) n = avail;
+    if (__copy_user(buf + done, &p->ring[tail & PIPE_RING_MASK], n))
+      return done ? done : -1;
+    tail += n;
+    avail -= n;
+    done += n;
+    pipe_barrier();
+    p->tail = tail;
+  }
+  return done;
+}
+
+/* pipe_release
+ * Inputs: index -- pipe being closed
+ *         end -- PIPE_READ_END or PIPE_WRITE_END
+ * Return Value: none
+ * Function: drops one end, frees the pipe when nobody holds it anymore */
+void pipe_release(uint32_t index, uint8_t end) {
+  pipe_t *p = &pipes[index];
+  irqoff_cli();
+  if (end == PIPE_READ_END && p->readers) p->readers--;
+  if (end == PIPE_WRITE_END && p->writers) p->writers--;
+  if (!p->readers && !p->writers) p->in_use = 0;
+  sched_wakeup(p);  // Let the other end notice
+  irqoff_sti();
+}
+
+/* pipe_open
+ * Inputs: filename -- unused
+ * Return Value: -1
+ * Function: pipes only come from the pipe syscall */
+int32_t pipe_open(const str filename) { return -1; }
+
+/* pipe_read
+ * Inputs: fd -- pipe index stored in the descriptor's inode field
+ *         buf -- destination buffer
+ *         nbytes -- max number of bytes to read
+ * Return Value: bytes read, 0 once the pipe is empty and has no writers,
+ *               -1 on a bad pipe or an unmapped buf
+ * Function: sleeps until data shows up like terminal_read does, then
+ * returns whatever is available without waiting for nbytes to fill. */
+int32_t pipe_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
+  pipe_t *p;
+  if (fd < 0 || fd >= NUM_PIPES || !pipes[fd].in_use) return -1;
+  if (!buf || nbytes < 0) return -1;
+  p = &pipes[fd];
+  irqoff_cli();
+  while (p->head == p->tail && p->writers)
+    sched_sleep_on(p);
+  sched_wait_done();
+  irqoff_sti();
+  if (p->head == p->tail) return 0;  // End of file
+  nbytes = pipe_pull(fd, (uint8_t *)buf, nbytes);
+  sched_wakeup(p);  // Writer may be waiting for room
+  return nbytes;
+}
+
+/* pipe_write
+ * Inputs: fd -- pipe index stored in the descriptor's inode field
+ *         buf -- bytes to write
+ *         nbytes -- number of bytes to write
+ * Return Value: bytes written, -1 if nothing could be written because the
+ *               read end is closed or buf isn't mapped
+ * Function: keeps pushing until the whole buffer went through the ring */
+int32_t pipe_write(int32_t fd, const void *buf, int32_t nbytes) {
+  pipe_t *p;
+  int32_t n, done = 0;
+  if (fd < 0 || fd >= NUM_PIPES || !pipes[fd].in_use) return -1;
+  if (!buf || nbytes < 0) return -1;
+  p = &pipes[fd];
+  while (done < nbytes) {
+    if (!p->readers) return done ? done : -1;  // Broken pipe
+    n = pipe_push(fd, (const uint8_t *)buf + done, nbytes - done);
+    if (n < 0) return done ? done : -1;
+    done += n;
+    sched_wakeup(p);  // Reader may be waiting for data
+    // Ring full: sleep until the reader drains some of it
+    irqoff_cli();
+    while (done < nbytes && p->readers &&
+           p->head - p->tail == PIPE_RING_SIZE)
+      sched_sleep_on(p);
+    sched_wait_done();
+    irqoff_sti();
+  }
+  return done;
+}
+
+/* pipe_read_close / pipe_write_close
+ * Inputs: fd -- file descriptor being closed in the current process
+ * Return Value: 0
+ * Function: close gets the descriptor number rather than the inode, so look
+ * the pipe index back up from the PCB */
+int32_t pipe_read_close(int32_t fd) {
+  pcb_t *pcb = processes[terminals[active_terminal].pid];
+  pipe_release(pcb->file_descriptors[fd].inode, PIPE_READ_END);
+  return 0;
+}
+
+int32_t pipe_write_close(int32_t fd) {
+  pcb_t *pcb = processes[terminals[active_terminal].pid];
+  pipe_release(pcb->file_descriptors[fd].inode, PIPE_WRITE_END);
+  return 0;
+}
+
+/* pipe_bad_read / pipe_bad_write
+ * Return Value: -1
+ * Function: reading the write end or writing the read end is an error */
+int32_t pipe_bad_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
+  return -1;
+}
+
+int32_t pipe_bad_write(int32_t fd, const void *buf, int32_t nbytes) {
+  return -1;
+}
@@ -0,0 +1,51 @@
+/* pipe.h - Kernel pipes: single-producer/single-consumer byte rings
+ */
+
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "../types.h"
+
+#define NUM_PIPES 8
+#define PIPE_PAGE_SIZE 0x1000  /* Most bytes published per copy: 4kB */
+#define PIPE_PAGE_SLOTS 4
+#define PIPE_RING_SIZE (PIPE_PAGE_SIZE * PIPE_PAGE_SLOTS)  /* Power of two */
+#define PIPE_RING_MASK (PIPE_RING_SIZE - 1)
+
+#define PIPE_READ_END 0
+#define PIPE_WRITE_END 1
+
+/* One pipe. head is only ever written by the producer and tail only by the
+ * consumer, so neither side needs cli() to touch the ring. Both counters
+ * run freely and are masked on access; head - tail is the fill level.
+ */
+typedef struct {
+  uint8_t in_use;
+  volatile uint8_t readers;  /* Open read ends */
+  volatile uint8_t writers;  /* Open write ends */
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  uint8_t ring[PIPE_RING_SIZE] __attribute__((aligned(PIPE_PAGE_SIZE)));
+} pipe_t;
+
+/* Reserve a pipe with one reader and one writer, returns its index or -1 */
+int32_t pipe_create(void);
+
+/* Non-blocking ring operations, return the number of bytes moved */
+int32_t pipe_push(uint32_t index, const uint8_t *buf, int32_t nbytes);
+int32_t pipe_pull(uint32_t index, uint8_t *buf, int32_t nbytes);
+
+/* Drop one end of the pipe, the pipe is freed once both sides are gone */
+void pipe_release(uint32_t index, uint8_t end);
+
+// open, read, write, and close for both ends of the pipe.
+// Pipes are created by the pipe syscall, they can't be opened by name.
+int32_t pipe_open(const str filename);
+int32_t pipe_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset);
+int32_t pipe_write(int32_t fd, const void *buf, int32_t nbytes);
+int32_t pipe_read_close(int32_t fd);
+int32_t pipe_write_close(int32_t fd);
+int32_t pipe_bad_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset);
+int32_t pipe_bad_write(int32_t fd, const void *buf, int32_t nbytes);
+
+#endif /* _PIPE_H */
@@ -1,4 +1,6 @@
 #include "pit.h"
+#include "../boottime.h"
+#include "../interrupt/irq.h"
 
 //https://wiki.osdev.org/Programmable_Interval_Timer
 
@@ -10,7 +12,16 @@
 #define HIGHEST_PIT_RATE 		1193182   	// highest pit rate 
 #define FULL_SHIFT				0xFF
 #define SHIFT_BY_8				8 	
-#define LOWEST_FREQUENCY 		65536		// lowest possible frequency 
+#define LOWEST_FREQUENCY 		PIT_TICK_RATE	// lowest possible frequency 
+
+/* Channel 2 is free for busy waits, its gate and output sit in port 0x61 */
+#define CHNL_2_DATA_OUT			0x42
+#define CMD_CHNL_2_ONESHOT		0xB0
+#define GATE_PORT				0x61
+#define GATE_ENABLE				0x01
+#define GATE_SPEAKER			0x02
+#define GATE_CHNL_2_OUT			0x20
+#define MAX_DELAY_US			54000		// 16 bit count at 1.19MHz
 
  /* NAME: set_pit_rate
 	INPUT: rate: takes in the rate 
@@ -35,9 +46,30 @@ void set_pit_rate(uint32_t rate){
 void pit_init(void){
 	
 	set_pit_rate((uint32_t)LOWEST_FREQUENCY ) ; // uses set_pit_rate function to initialize PIT to 10ms 
+	request_irq(PIT_IRQNUM, handle_timer, "timer", NULL, 0);
 												
 												// Maybe want to have a tick counter or set to 0 
-	
+	boot_phase("pit");
+	}
+
+ /* NAME: pit_delay_us
+	INPUT: us: microseconds to wait, at most 54ms
+	OUTPUT: none
+	DISCRIPTION: Busy waits on channel 2 in one shot mode. Channel 0 and
+	its interrupt are left alone, so this works with interrupts off. */
+void pit_delay_us(uint32_t us){
+	uint32_t count;
+	uint8_t gate;
+	if (us > MAX_DELAY_US) us = MAX_DELAY_US;
+	count = (HIGHEST_PIT_RATE / 1000) * us / 1000;
+	if (!count) count = 1;
+	gate = inb(GATE_PORT) & ~(GATE_SPEAKER | GATE_ENABLE);
+	outb(gate, GATE_PORT);
+	outb(CMD_CHNL_2_ONESHOT, ADDR_MODE_OUT);
+	outb(count & FULL_SHIFT, CHNL_2_DATA_OUT);
+	outb(count >> SHIFT_BY_8, CHNL_2_DATA_OUT);
+	outb(gate | GATE_ENABLE, GATE_PORT);	// rising edge on the gate starts it
+	while (!(inb(GATE_PORT) & GATE_CHNL_2_OUT));
 	}
 
 
@@ -4,8 +4,12 @@
 #include "../types.h"
 #include "../x86_desc.h"
 
+#define PIT_TICK_RATE 65536  // Hz, rate programmed by pit_init()
+#define PIT_IRQNUM 0
+
 
 void set_pit_rate(uint32_t rate); 
 void pit_init(void); 
+void pit_delay_us(uint32_t us);
 
 #endif /* _PIT_H */
@@ -0,0 +1,194 @@
+#include "procfs.h"
+#include "pit.h"
+#include "terminal.h"
+#include "../lib.h"
+#include "../shm.h"
+#include "../kmalloc.h"
+#include "../buddy.h"
+#include "../boottime.h"
+#include "../smp.h"
+#include "../irqoff.h"
+#include "../interrupt/process.h"
+#include "../interrupt/sched.h"
+#include "../interrupt/handler.h"
+#include "../interrupt/irq.h"
+#include "../uaccess.h"
+#include "../trace.h"
+#include "../execcache.h"
+
+/* PIT ticks to milliseconds. PIT_TICK_RATE is 2^16, so this is
+ * ticks * 1000 / 65536, split into whole seconds and the fraction. The
+ * tick counters are 64 bits wide, a uint32 of them would wrap after 2^32
+ * ticks (about 18.2 hours); what's printed is the low 32 bits of the
+ * millisecond count, which wraps after 49 days. */
+#define PIT_TICKS_TO_MS(ticks) \
+  (((ticks) >> 16) * 1000 + ((((ticks) & 0xFFFF) * 1000) >> 16))
+#define USER_PAGE_KB 4096
+
+static void procfs_gen_dir(procfs_out_t *out);
+static void procfs_gen_top(procfs_out_t *out);
+
+/* Entry 0 is the directory itself, reading it lists the others */
+static procfs_entry_t procfs_entries[] = {
+  {PROCFS_DIR_NAME, procfs_gen_dir},
+  {"top", procfs_gen_top},
+  {"slabinfo", kmem_slabinfo},
+  {"buddyinfo", buddy_info},
+  {"boot", boot_info},
+  {"cpus", smp_info},
+  {"irqs", irq_info},
+  {"softirqs", softirq_info},
+  {"irqoff", irqoff_info},
+  {"trace", trace_info},
+  {"execcache", exec_cache_info},
+};
+#define PROCFS_NUM_ENTRIES (sizeof(procfs_entries) / sizeof(procfs_entries[0]))
+
+/* Contents handed out by procfs_read, rendered when a read starts at 0 so
+ * that a file read in several chunks stays consistent */
+static int8_t procfs_snapshot[PROCFS_BUF_SIZE];
+static uint32_t procfs_snapshot_len;
+
+/* procfs_puts
+ * Inputs: out -- output being rendered
+ *         s -- string to append
+ * Return Value: none
+ * Function: appends s, truncating at the end of the buffer */
+void procfs_puts(procfs_out_t *out, const int8_t *s) {
+  while (*s && out->len < out->size)
+    out->buf[out->len++] = *s++;
+}
+
+/* procfs_putu
+ * Inputs: out -- output being rendered
+ *         value -- number to append in decimal
+ *         width -- right align in this many columns, 0 for none
+ * Return Value: none
+ * Function: appends a right aligned unsigned number */
+void procfs_putu(procfs_out_t *out, uint32_t value, uint32_t width) {
+  int8_t digits[11];
+  uint32_t n;
+  itoa(value, digits, 10);
+  for (n = strlen(digits); n < width; n++)
+    procfs_puts(out, " ");
+  procfs_puts(out, digits);
+}
+
+/* procfs_lookup
+ * Inputs: filename -- name passed to open
+ * Return Value: index of the pseudo-file, -1 if it isn't one
+ * Function: matches "proc" and "proc/<entry>" */
+int32_t procfs_lookup(const str filename) {
+  uint32_t i, prefix = strlen(PROCFS_DIR_NAME);
+  if (strncmp(filename, PROCFS_DIR_NAME, prefix)) return -1;
+  if (!filename[prefix]) return 0;
+  if (filename[prefix] != '/') return -1;
+  for (i = 1; i < PROCFS_NUM_ENTRIES; i++) {
+    if (!strncmp(filename + prefix + 1, procfs_entries[i].name,
+                 PROCFS_NAME_LENGTH))
+      return i;
+  }
+  return -1;
+}
+
+int32_t procfs_open(const str filename) { return 0; }
+
+int32_t procfs_close(int32_t fd) { return 0; }
+
+/* procfs_read
+ * Inputs: fd -- pseudo-file index stored in the descriptor's inode field
+ *         buf -- destination buffer
+ *         nbytes -- max number of bytes to read
+ *         offset -- file position
+ * Return Value: bytes read, 0 at the end, -1 on a bad index or buf
+ * Function: regenerates the file when reading from the start, then serves
+ * the snapshot like a regular file */
+int32_t procfs_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
+  procfs_out_t out;
+  if (fd < 0 || fd >= (int32_t)PROCFS_NUM_ENTRIES || !buf || nbytes < 0)
+    return -1;
+  if (!offset) {
+    out.buf = procfs_snapshot;
+    out.len = 0;
+    out.size = PROCFS_BUF_SIZE;
+    procfs_entries[fd].generate(&out);
+    procfs_snapshot_len = out.len;
+  }
+  if ((uint32_t)offset >= procfs_snapshot_len) return 0;
+  if ((uint32_t)nbytes > procfs_snapshot_len - offset)
+    nbytes = procfs_snapshot_len - offset;
+  if (__copy_user(buf, procfs_snapshot + offset, nbytes)) return -1;
+  return nbytes;
+}
+
+int32_t procfs_write(int32_t fd, const void *buf, int32_t nbytes) {
+  return -1;
+}
+
+/* "proc": one entry name per line */
+static void procfs_gen_dir(procfs_out_t *out) {
+  uint32_t i;
+  for (i = 1; i < PROCFS_NUM_ENTRIES; i++) {
+    procfs_puts(out, procfs_entries[i].name);
+    procfs_puts(out, "\n");
+  }
+}
+
+/* "proc/top": CPU usage and per process counters */
+static void procfs_gen_top(procfs_out_t *out) {
+  uint64_t total64, idle64;
+  uint32_t total, idle, ms, flags;
+  uint8_t pid;
+  int32_t term;
+  pcb_t *pcb;
+
+  // Both halves of each counter from the same tick
+  irqoff_save(flags);
+  total64 = sched_total_ticks;
+  idle64 = sched_idle_ticks;
+  irqoff_restore(flags);
+  ms = PIT_TICKS_TO_MS(total64);
+  // Scaled down for the percentage, the kernel has no 64-bit divide
+  while (total64 >> 32) {
+    total64 >>= 1;
+    idle64 >>= 1;
+  }
+  total = total64;
+  idle = idle64;
+
+  procfs_puts(out, "cpu idle ");
+  procfs_putu(out, total >= 100 ? idle / (total / 100) : 0, 0);
+  procfs_puts(out, "% of ");
+  procfs_putu(out, ms, 0);
+  procfs_puts(out, " ms\n");
+  procfs_puts(out, "PID PPID TTY STATE  USER(ms) KERN(ms) SYSCALLS"
+                   " SWITCHES RSS(kB) NAME\n");
+  for (pid = MIN_PID; pid < num_pids; pid++) {
+    pcb = processes[pid];
+    if (!pcb->in_use) continue;
+    term = pcb->terminal;
+    procfs_putu(out, pid, 3);
+    procfs_putu(out, pcb->parent_pid, 5);
+    procfs_putu(out, term, 4);
+    // A process with a foreground child waits in execute()
+    if (pcb->zombie)
+      procfs_puts(out, " zombie");
+    else if (pcb->exec_child)
+      procfs_puts(out, " child ");
+    else if (pcb->waiting)
+      procfs_puts(out, " sleep ");
+    else if (term == cpus[smp_terminal_cpu(term)].terminal && terminals[term].pid == pid)
+      procfs_puts(out, " run   ");
+    else
+      procfs_puts(out, " ready ");
+    procfs_putu(out, PIT_TICKS_TO_MS(pcb->user_ticks), 9);
+    procfs_putu(out, PIT_TICKS_TO_MS(pcb->kernel_ticks), 9);
+    procfs_putu(out, pcb->syscall_count, 9);
+    procfs_putu(out, pcb->switch_count, 9);
+    procfs_putu(out, USER_PAGE_KB + PROCESS_KERNEL_STACK_SIZE / 1024 +
+                     shm_attached_pages(pid) * SHM_PAGE_SIZE / 1024, 8);
+    procfs_puts(out, " ");
+    procfs_puts(out, pcb->name);
+    procfs_puts(out, "\n");
+  }
+}
@@ -0,0 +1,42 @@
+/* procfs.h - Read-only pseudo-files generated by the kernel
+ */
+
+#ifndef _PROCFS_H
+#define _PROCFS_H
+
+#include "../types.h"
+
+#define PROCFS_DIR_NAME "proc"
+#define PROCFS_NAME_LENGTH 32
+#define PROCFS_BUF_SIZE 2048  /* Largest file a generator can produce */
+
+/* Text being rendered by a generator */
+typedef struct {
+  int8_t *buf;
+  uint32_t len;
+  uint32_t size;
+} procfs_out_t;
+
+/* Fills out with the file contents */
+typedef void (*procfs_gen_t)(procfs_out_t *out);
+
+typedef struct {
+  int8_t name[PROCFS_NAME_LENGTH];
+  procfs_gen_t generate;
+} procfs_entry_t;
+
+/* Formatting helpers for generators. Output past size is dropped. */
+void procfs_puts(procfs_out_t *out, const int8_t *s);
+void procfs_putu(procfs_out_t *out, uint32_t value, uint32_t width);
+
+/* Index to store in the descriptor's inode for "proc" or "proc/<name>",
+ * -1 if filename isn't a pseudo-file */
+int32_t procfs_lookup(const str filename);
+
+/* Driver functions */
+int32_t procfs_open(const str filename);
+int32_t procfs_close(int32_t fd);
+int32_t procfs_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset);
+int32_t procfs_write(int32_t fd, const void *buf, int32_t nbytes);
+
+#endif /* _PROCFS_H */
@@ -1,11 +1,21 @@
 #include "rtc.h"
-#include "../i8259.h"
+#include "../apic.h"
 #include "../lib.h"
+#include "../interrupt/irq.h"
+#include "../interrupt/sched.h"
+#include "../tsc.h"
+#include "../boottime.h"
+#include "../spinlock.h"
+#include "../irqoff.h"
+#include "../uaccess.h"
 
 // vars for testings
 static uint32_t test_ticks;
 int test_flag;
 volatile uint8_t interrupt_recieved;
+volatile uint64_t rtc_irq_tsc;  // when the last interrupt came in
+/* The CMOS index and data ports have to be used as a pair */
+static spinlock_t rtc_lock = SPINLOCK_INIT;
 
 /*lookup table get frequency codes*/
 const uint8_t RATE_TABLE[15] = {
@@ -31,10 +41,11 @@ const uint8_t RATE_TABLE[15] = {
  * Return Value: none
  * Function: initializes the RTC device */
 void rtc_init(void) {
+  uint32_t flags;
 
   // REF OSDev https://wiki.osdev.org/RTC, Dallas Semiconductor DS12887 Real
   // Time Clock datasheet
-  cli();
+  spin_lock_irqsave(&rtc_lock, flags);
 
   test_flag = 0; // turns off testing ticks
 
@@ -52,8 +63,9 @@ void rtc_init(void) {
        RTC_CMOS_PORT); // Sets PIE bit to one, enables square wave, binary
                        // calendar data, 24 hour mode, and daylight savings
 
-  enable_irq(RTC_IRQNUM); // enables the RTC irq line on the PIC
-  sti();
+  request_irq(RTC_IRQNUM, handle_rtc, "rtc", NULL, 0); // unmasks the line
+  spin_unlock_irqrestore(&rtc_lock, flags);
+  boot_phase("rtc");
 }
 
 /* rtc_enable_period_irq
@@ -61,7 +73,8 @@ void rtc_init(void) {
  * Return Value: none
  * Function: enables periodic irqs*/
 void rtc_enable_period_irq(void) {
-  cli(); // disable interrupts
+  uint32_t flags;
+  spin_lock_irqsave(&rtc_lock, flags);
 
   /* setting RTC B register */
   outb(RTC_B_REG, RTC_PORT);
@@ -69,7 +82,7 @@ void rtc_enable_period_irq(void) {
   outb(b_old | 0x40,
        RTC_CMOS_PORT); // Sets PIE bit to one (enables periodic interrupts)
 
-  sti();
+  spin_unlock_irqrestore(&rtc_lock, flags);
 }
 
 /* rtc_disable_period_irq
@@ -77,7 +90,8 @@ void rtc_enable_period_irq(void) {
  * Return Value: none
  * Function: disables the periodic irqs */
 void rtc_disable_period_irq(void) {
-  cli(); // disable interrupts
+  uint32_t flags;
+  spin_lock_irqsave(&rtc_lock, flags);
 
   /* setting RTC B register */
   outb(RTC_B_REG, RTC_PORT);
@@ -85,7 +99,7 @@ void rtc_disable_period_irq(void) {
   outb(b_old & 0xBF,
        RTC_CMOS_PORT); // Sets PIE bit to zero (disables periodic interrupts)
 
-  sti();
+  spin_unlock_irqrestore(&rtc_lock, flags);
 }
 
 /* rtc_set_rate
@@ -93,8 +107,7 @@ void rtc_disable_period_irq(void) {
  * Return Value: 0 on success, -1 on failure (invalid frequency arg)
  * Function: sets the frequency of the RTC's periodic interrupts */
 int rtc_set_rate(uint16_t rate) {
-  cli();
-
+  uint32_t flags;
   uint8_t rate_code = 0xFF;
   int power = 0;
 
@@ -112,22 +125,37 @@ int rtc_set_rate(uint16_t rate) {
   }                              // if a non power of two, return error
   rate_code = RATE_TABLE[power]; // get corrosponding rate code from our table
 
+  spin_lock_irqsave(&rtc_lock, flags);
   outb(RTC_A_REG, RTC_PORT);             // swtich to rtc A register
   outb(rate_code | 0x40, RTC_CMOS_PORT); // Sets rate using our rate code
-  sti();
+  spin_unlock_irqrestore(&rtc_lock, flags);
 
   return 0; // return success
 }
 
+/* rtc_ack_irq
+ * Inputs: none
+ * Return Value: none
+ * Function: reads register C, without which the RTC raises no further
+ * interrupts, and stamps rtc_irq_tsc. For use by the RTC top half */
+void rtc_ack_irq(void) {
+  rtc_irq_tsc = rdtsc();
+  spin_lock(&rtc_lock);
+  outb(RTC_C_REG & 0x7F, RTC_PORT); // select register C
+  inb(RTC_CMOS_PORT);               // discard value
+  spin_unlock(&rtc_lock);
+}
+
 /* rtc_interrupt_recieved
  * Inputs: none
  * Return Value: none
- * Function: sets the recieved interrupt flag. for use by the RTC interrupt
- * handler*/
+ * Function: sets the recieved interrupt flag and wakes up readers. for use
+ * by the RTC bottom half*/
 void rtc_interrupt_recieved(void) {
+  // a single store, and sched_wakeup masks interrupts itself, so this is
+  // fine to run with interrupts on
   interrupt_recieved = 1;
-  // doesnt need cli/sti because is only called from rtc handler which is
-  // already protected.
+  sched_wakeup((void *)&interrupt_recieved);
 }
 
 /* rtc_open
@@ -141,17 +169,16 @@ int32_t rtc_open(const str filename) { return rtc_set_rate(2); }
  *         buf -- A pointer to a buffer, not used here
  *         nbytes -- the number of bytes to read, not used here
  * Return Value: 0 on success, -1 on failure
- * Function: This function "spinlocks" until another RTC interrupt is recieved,
- * which creates a sleep effect with the length based on the RTC frequency*/
+ * Function: This function sleeps until another RTC interrupt is recieved,
+ * which creates a sleep effect with the length based on the RTC frequency.
+ * The CPU is halted (or handed to another process) in the meantime*/
 int32_t rtc_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
-  cli();
+  irqoff_cli();
   interrupt_recieved = 0;
-  sti();
-  while (1) { // waits until a single rtc interrupt has been recieved
-    if (interrupt_recieved) {
-      break;
-    }
-  }
+  while (!interrupt_recieved) // waits until a single rtc interrupt has been recieved
+    sched_sleep_on((void *)&interrupt_recieved);
+  sched_wait_done();
+  irqoff_sti();
   return 0;
 }
 
@@ -159,22 +186,22 @@ int32_t rtc_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
  * Inputs: fd -- an RTC file descriptor
  *         buf -- A pointer to a buffer, should contain an int representing the
  * desired hz power of two. nbytes -- the number of bytes to read, should always
- * be 4 Return Value: 0 on success, -1 on failure (invalid freqeuncy)
+ * be 4 Return Value: 0 on success, -1 on failure (invalid freqeuncy or buf)
  * Function: sets the frequency of the RTC, up to 1024Hz */
 int32_t rtc_write(int32_t fd, const void *buf, int32_t nbytes) {
-  cli();
   if (nbytes != 4 || buf == 0) {
     return -1;
   } // should only accept a 4 byte arg and non null pointer
-  int32_t rate =
-      *((const int32_t *)buf); // get the 4 byte arg from provided pointer
+  int32_t rate;
+  if (__copy_user(&rate, buf, 4)) {
+    return -1;
+  } // get the 4 byte arg from provided pointer, which may not be mapped
   if (rate > 1024) {
     return -1;
   } // user calls are restricted to 1024Hz
   if (rtc_set_rate(rate) == 0) {
     return 4;
   } // if success, return 4
-  sti();
   return -1; // else return error
 }
 
@@ -40,9 +40,15 @@ void rtc_disable_period_irq(void);
 /* change RTC interrupt frequency rate to a power of two*/
 int rtc_set_rate(uint16_t rate);
 
+/* reads register C so the RTC keeps interrupting */
+void rtc_ack_irq(void);
+
 /* sets the received interrupt flag */
 void rtc_interrupt_recieved(void);
 
+/* TSC at the last RTC interrupt, for wakeup latency measurements */
+extern volatile uint64_t rtc_irq_tsc;
+
 // open, read, write, and close
 
 /* The call should find the directory entry corresponding to the
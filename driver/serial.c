@@ -0,0 +1,199 @@
+#include "serial.h"
+#include "../apic.h"
+#include "../lib.h"
+#include "../interrupt/irq.h"
+#include "../irqoff.h"
+#include "../uaccess.h"
+
+#define LCR_DLAB 0x80
+#define LCR_8N1 0x03
+#define FCR_ENABLE_CLEAR 0xC7  // FIFOs on and cleared, RX trigger at 14
+#define MCR_DTR_RTS_OUT2 0x0B  // OUT2 gates the IRQ line
+#define IER_RX 0x01
+#define IER_THRE 0x02
+#define IIR_NO_INT 0x01
+#define IIR_CAUSE 0x0E
+#define IIR_MODEM 0x00
+#define IIR_THRE 0x02
+#define IIR_RX 0x04
+#define IIR_LINE 0x06
+#define IIR_RX_TIMEOUT 0x0C
+#define LSR_DATA 0x01
+#define LSR_THRE 0x20
+#define SCRATCH_TEST 0x5A
+#define SERIAL_COPY_CHUNK 64  // Bounce buffer between user memory and the rings
+
+uint8_t serial_mirror = 1;
+
+static int8_t tx_ring[SERIAL_TX_SIZE];
+static volatile uint32_t tx_head, tx_tail;  // Free running, head - tail is the fill
+static int8_t rx_ring[SERIAL_RX_SIZE];
+static volatile uint32_t rx_head, rx_tail;
+static uint8_t ier;
+static int8_t serial_state;  // 0 untouched, 1 ready, -1 no UART
+
+/* serial_init
+ * Inputs: none
+ * Return Value: 0 on success, -1 if no UART answers
+ * Function: 115200 8N1 with FIFOs, receive interrupts on. Transmit
+ * interrupts are only turned on while there is something to send. */
+int32_t serial_init(void) {
+  uint32_t flags;
+  if (serial_state) return serial_state == 1 ? 0 : -1;
+  irqoff_save(flags);
+  // Nothing behind the port reads back 0xFF
+  outb(SCRATCH_TEST, SERIAL_PORT + SERIAL_SCRATCH);
+  if (inb(SERIAL_PORT + SERIAL_SCRATCH) != SCRATCH_TEST) {
+    serial_state = -1;
+    irqoff_restore(flags);
+    return -1;
+  }
+  outb(0, SERIAL_PORT + SERIAL_IER);
+  outb(LCR_DLAB, SERIAL_PORT + SERIAL_LCR);
+  outb(SERIAL_DIVISOR & 0xFF, SERIAL_PORT + SERIAL_DATA);
+  outb(SERIAL_DIVISOR >> 8, SERIAL_PORT + SERIAL_IER);
+  outb(LCR_8N1, SERIAL_PORT + SERIAL_LCR);
+  outb(FCR_ENABLE_CLEAR, SERIAL_PORT + SERIAL_IIR);
+  outb(MCR_DTR_RTS_OUT2, SERIAL_PORT + SERIAL_MCR);
+  tx_head = tx_tail = 0;
+  rx_head = rx_tail = 0;
+  ier = IER_RX;
+  outb(ier, SERIAL_PORT + SERIAL_IER);
+  serial_state = 1;
+  // Shared: a handler that finds nothing pending lets the others look
+  request_irq(SERIAL_IRQNUM, handle_serial, "serial", NULL, IRQF_SHARED);
+  irqoff_restore(flags);
+  return 0;
+}
+
+/* serial_fill_fifo
+ * Inputs: none
+ * Return Value: none
+ * Function: moves up to a FIFO's worth of bytes from the ring into the
+ * UART. Only called when the transmitter reported empty. */
+static void serial_fill_fifo(void) {
+  int i;
+  for (i = 0; i < SERIAL_FIFO_DEPTH && tx_tail != tx_head; i++) {
+    outb(tx_ring[tx_tail & (SERIAL_TX_SIZE - 1)], SERIAL_PORT + SERIAL_DATA);
+    tx_tail++;
+  }
+}
+
+/* serial_interrupt
+ * Inputs: none
+ * Return Value: 1 if the UART had anything pending, 0 if the interrupt
+ * came from another device on the line
+ * Function: services every pending UART condition. THR empty refills the
+ * FIFO, or turns the interrupt off once the ring is drained. */
+int32_t serial_interrupt(void) {
+  uint8_t iir;
+  int32_t serviced = 0;
+  while (!((iir = inb(SERIAL_PORT + SERIAL_IIR)) & IIR_NO_INT)) {
+    serviced = 1;
+    switch (iir & IIR_CAUSE) {
+    case IIR_THRE:
+      serial_fill_fifo();
+      if (tx_tail == tx_head) {
+        ier &= ~IER_THRE;
+        outb(ier, SERIAL_PORT + SERIAL_IER);
+      }
+      break;
+    case IIR_RX:
+    case IIR_RX_TIMEOUT:
+      while (inb(SERIAL_PORT + SERIAL_LSR) & LSR_DATA) {
+        uint8_t c = inb(SERIAL_PORT + SERIAL_DATA);
+        if (rx_head - rx_tail < SERIAL_RX_SIZE)
+          rx_ring[rx_head++ & (SERIAL_RX_SIZE - 1)] = c;
+      }
+      break;
+    case IIR_LINE:
+      inb(SERIAL_PORT + SERIAL_LSR);
+      break;
+    default:  // IIR_MODEM
+      inb(SERIAL_PORT + SERIAL_MSR);
+      break;
+    }
+  }
+  return serviced;
+}
+
+/* serial_write_bytes
+ * Inputs: buf -- bytes to send
+ *         nbytes -- how many
+ * Return Value: nbytes, -1 without a UART
+ * Function: queues the bytes and makes sure the THR empty interrupt is on
+ * to pick them up. Safe with interrupts off. */
+int32_t serial_write_bytes(const int8_t *buf, int32_t nbytes) {
+  uint32_t flags;
+  int32_t i;
+  if (serial_init()) return -1;
+  irqoff_save(flags);
+  for (i = 0; i < nbytes; i++) {
+    if (tx_head - tx_tail == SERIAL_TX_SIZE) {
+      // Ring full: can't count on the interrupt, push a FIFO load by hand
+      while (!(inb(SERIAL_PORT + SERIAL_LSR) & LSR_THRE));
+      serial_fill_fifo();
+    }
+    tx_ring[tx_head++ & (SERIAL_TX_SIZE - 1)] = buf[i];
+  }
+  if (!(ier & IER_THRE) && tx_head != tx_tail) {
+    // Raises an interrupt right away if the transmitter is idle
+    ier |= IER_THRE;
+    outb(ier, SERIAL_PORT + SERIAL_IER);
+  }
+  irqoff_restore(flags);
+  return nbytes;
+}
+
+void serial_puts(const int8_t *s) {
+  serial_write_bytes(s, strlen(s));
+}
+
+/* serial_open
+ * Inputs: filename -- unused
+ * Return Value: 0 on success, -1 without a UART */
+int32_t serial_open(const str filename) { return serial_init(); }
+
+int32_t serial_close(int32_t fd) { return 0; }
+
+/* serial_read
+ * Inputs: buf -- destination buffer
+ *         nbytes -- max number of bytes to read
+ * Return Value: bytes received so far, 0 if none, -1 if buf isn't mapped.
+ * Does not wait. The ring is drained through a bounce buffer so buf is
+ * never touched with interrupts off. */
+int32_t serial_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
+  int8_t chunk[SERIAL_COPY_CHUNK];
+  int32_t n, done = 0;
+  uint32_t flags;
+  if (!buf || nbytes < 0) return -1;
+  do {
+    irqoff_save(flags);
+    for (n = 0; n < SERIAL_COPY_CHUNK && done + n < nbytes && rx_tail != rx_head;
+         n++)
+      chunk[n] = rx_ring[rx_tail++ & (SERIAL_RX_SIZE - 1)];
+    irqoff_restore(flags);
+    if (__copy_user((int8_t *)buf + done, chunk, n)) return -1;
+    done += n;
+  } while (n == SERIAL_COPY_CHUNK);
+  return done;
+}
+
+/* serial_write
+ * Inputs: buf -- bytes to send
+ *         nbytes -- number of bytes
+ * Return Value: bytes queued, -1 on failure or if buf isn't mapped */
+int32_t serial_write(int32_t fd, const void *buf, int32_t nbytes) {
+  int8_t chunk[SERIAL_COPY_CHUNK];
+  int32_t n, done = 0;
+  if (!buf || nbytes < 0 || serial_init()) return -1;
+  while (done < nbytes) {
+    n = nbytes - done;
+    if (n > SERIAL_COPY_CHUNK) n = SERIAL_COPY_CHUNK;
+    if (__copy_user(chunk, (const int8_t *)buf + done, n))
+      return done ? done : -1;
+    serial_write_bytes(chunk, n);
+    done += n;
+  }
+  return done;
+}
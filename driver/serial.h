@@ -0,0 +1,50 @@
+/* serial.h - 16550 UART console on COM1
+ */
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include "../types.h"
+
+/*IRQ line number that corrosponds to COM1*/
+#define SERIAL_IRQNUM 4
+#define SERIAL_PORT 0x3F8
+
+/* Register offsets from SERIAL_PORT */
+#define SERIAL_DATA 0      /* THR on write, RBR on read, DLL with DLAB */
+#define SERIAL_IER 1       /* DLM with DLAB */
+#define SERIAL_IIR 2       /* FCR on write */
+#define SERIAL_LCR 3
+#define SERIAL_MCR 4
+#define SERIAL_LSR 5
+#define SERIAL_MSR 6
+#define SERIAL_SCRATCH 7
+
+#define SERIAL_DIVISOR 1   /* 115200 baud */
+#define SERIAL_FIFO_DEPTH 16
+#define SERIAL_TX_SIZE 4096  /* Power of two */
+#define SERIAL_RX_SIZE 256   /* Power of two */
+
+#define SERIAL_DEVICE_NAME "serial"
+
+/* Copy terminal output to the serial port as well, for -nographic runs */
+extern uint8_t serial_mirror;
+
+/* Programs the UART. Done on first use, returns -1 if there is no UART */
+int32_t serial_init(void);
+
+/* Called from the IRQ4 handler, returns 1 if the UART was asking */
+int32_t serial_interrupt(void);
+
+/* Queues bytes for transmission. Never blocks on interrupts: when the ring
+ * is full, the FIFO is drained by polling. */
+int32_t serial_write_bytes(const int8_t *buf, int32_t nbytes);
+void serial_puts(const int8_t *s);
+
+/* Driver functions */
+int32_t serial_open(const str filename);
+int32_t serial_close(int32_t fd);
+int32_t serial_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset);
+int32_t serial_write(int32_t fd, const void *buf, int32_t nbytes);
+
+#endif /* _SERIAL_H */
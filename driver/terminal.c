@@ -3,11 +3,23 @@
 #include "keyboard.h"
 #include "../interrupt/syscall.h"
 #include "../interrupt/process.h"
+#include "../interrupt/signal.h"
+#include "../interrupt/sched.h"
+#include "../interrupt/handler.h"
 #include "../paging.h"
+#include "../tlb.h"
+#include "../boottime.h"
+#include "../kmalloc.h"
+#include "../fastmem.h"
+#include "../spinlock.h"
+#include "serial.h"
+#include "../irqoff.h"
+#include "../uaccess.h"
 
 terminal_t terminals[NUM_TERMINALS];
 
-void set_terminal_vmem(uint8_t target);
+/* Guards the input buffers and the shared cursor (screen_x/y) */
+static spinlock_t terminal_lock = SPINLOCK_INIT;
 
 /**
  * Foreground terminal is the terminal actually shown to user and accepting user input.
@@ -17,16 +29,12 @@ void set_terminal_vmem(uint8_t target);
 int foreground_terminal = 0;
 
 /**
- * Active terminal is the terminal whose active process is being executed.
- * If active terminal is not the foreground, its virtual address must point
- * at its offscreen video memory buffer.
+ * Active terminal is the terminal whose active process is being executed,
+ * one per CPU (cpu_t.terminal, see terminal.h). If active terminal is not
+ * the foreground, its virtual address must point at its offscreen video
+ * memory buffer. previous_terminal saves what terminal we are switching
+ * away from, used during process switching.
  */
-int active_terminal = 0;
-
-/* Temporary variable that saves what terminal we are switching away from,
- * used during process switching.
- */
-int previous_terminal = 0;
 
 // BEGIN CP2.1
 
@@ -40,53 +48,79 @@ int32_t terminal_open(const str filename) { return 0; }
 /* Syscall interface for reading line from terminal til Enter key
  * Inputs: - buf: pointer to your buffer
  *         - nbytes: max number of bytes to read
- * Return value: Actual number of chars read
+ * Return value: Actual number of chars read, -1 if buf isn't mapped
  * Side effect: After read, terminal buffer is cleared.
  */
 int32_t terminal_read(int32_t fd, void *buf, int32_t nbytes, int32_t offset) {
-  cli();
   terminal_t *cur_term = &(terminals[active_terminal]);
-  sti();
   int i;
-  char *charbuf = (char *)buf;
-  // Now we wait for the terminal to complete a line of input
+  uint32_t flags;
+  char line[SIZE_INPUT_BUFFER];
+  // Now we wait for the terminal to complete a line of input, halted
+  // rather than spinning so the scheduler can run someone else
+  irqoff_cli();
   while (!cur_term->read_complete)
-    ;
+    sched_sleep_on(cur_term);
+  sched_wait_done();
+  irqoff_sti();
   //puts("Done read\n");
+  spin_lock_irqsave(&terminal_lock, flags);
   // If asking for more than we have, we truncate it
   if (nbytes >= cur_term->buffer_pos)
     nbytes = cur_term->buffer_pos;
-  // We could have used strncpy but we want a length here..
-  // So reinventing the wheel.
-  // Also this is a contingency plan if str is corrupted..
-  for (i = 0; i < nbytes; i++)
-    charbuf[i] = cur_term->input_buffer[i];
+  if (nbytes < 0)
+    nbytes = 0;
+  // Not strncpy: we want a length here, and it survives a corrupted str.
+  // The line goes out through a local copy, buf may fault and that must
+  // not happen under the lock.
+  fast_memcpy(line, cur_term->input_buffer, nbytes);
+  i = nbytes;
   // Wrapup: Clear the terminal buffer
   cur_term->read_complete = 0;
   cur_term->buffer_pos = 0;
   cur_term->input_buffer[0] = 0;
+  spin_unlock_irqrestore(&terminal_lock, flags);
+  if (__copy_user(buf, line, i)) return -1;
   return i;
 }
 
 /* Syscall interface for writing string to terminal
  * Inputs: - buf: pointer to string to write
  *         - nbytes: Number of bytes to write
- * Return value: Actual number of chars written
+ * Return value: Actual number of chars written, -1 if buf isn't mapped
+ *               before anything was written
  * Side effect: String put into the buffer
  */
 int32_t terminal_write(int32_t fd, const void *buf, int32_t nbytes) {
-  cli();
-  int i;
-  char *charbuf = (char *)buf;
-  for (i = 0; i < nbytes; i++) {
+  int i = 0, j, n, len;
+  uint32_t flags;
+  char chunk[TERMINAL_WRITE_CHUNK];
+  // One chunk at a time, so a long write doesn't hold interrupts off
+  // (and keystrokes back) for the whole buffer. The cursor is saved after
+  // every chunk in case the scheduler switches terminals in between. Each
+  // chunk is copied in before taking the lock, since buf may fault. A
+  // chunk stops at the end of nbytes and of buf's page: a string that
+  // ends near the top of the user page mustn't fail on what follows it.
+  while (i < nbytes) {
+    len = nbytes - i;
+    if (len > TERMINAL_WRITE_CHUNK) len = TERMINAL_WRITE_CHUNK;
+    if (len > (int)user_page_left((const char *)buf + i))
+      len = user_page_left((const char *)buf + i);
+    if (__copy_user(chunk, (const char *)buf + i, len))
+      return i ? i : -1;
     // String ends? I'll just end.
-    if (!charbuf[i])
-      break;
-    putc(charbuf[i]);
+    for (n = 0; n < len && chunk[n]; n++);
+    if (!n) break;
+    spin_lock_irqsave(&terminal_lock, flags);
+    for (j = 0; j < n; j++)
+      putc(chunk[j]);
+    if (serial_mirror) serial_write_bytes(chunk, n);
+    backup_cursor(active_terminal);
+    if (foreground_terminal == active_terminal) set_cursor();
+    spin_unlock_irqrestore(&terminal_lock, flags);
+    i += n;
+    if (n < len) break;
   }
-  backup_cursor(active_terminal);
-  if (foreground_terminal == active_terminal) set_cursor();
-  sti();
   return i; // Number of bytes written
 }
 
@@ -97,36 +131,53 @@ int32_t terminal_write(int32_t fd, const void *buf, int32_t nbytes) {
  */
 int32_t terminal_close(int32_t fd) { return 0; }
 
+/* Sets up a terminal the first time it is visited
+ * Inputs: - target: Terminal number
+ * Return value: 0 on success, -1 if no page is left for its buffer
+ * Side effect: Video buffer allocated and blanked, input and cursor reset
+ */
+int32_t terminal_prepare(uint8_t target) {
+  terminal_t *term = &(terminals[target]);
+  if (term->ready)
+    return 0;
+  term->video_buffer = kheap_page_alloc();
+  if (!term->video_buffer)
+    return -1;
+  // One word per cell instead of two byte stores
+  memset_word(term->video_buffer, (ATTRIB << 8) | ' ', NUM_COLS * NUM_ROWS);
+  term->input_buffer[0] = 0;
+  // Initialize the states
+  term->buffer_pos = 0;    // Resets the buffer write head
+  term->read_complete = 0; // Resets the completion flag
+  // Initialize the cursor
+  term->cursor_x = 0;
+  term->cursor_y = 0;
+  term->ready = 1;
+  // Its CPU may be halted, waiting for something to run
+  smp_kick(smp_terminal_cpu(target));
+  return 0;
+}
+
 /* Initializes all terminals, and put the first one on screen
  * Inputs: None
  * Return value: none
- * Side effect: All terminals buffers cleared and inited
+ * Side effect: First terminal cleared and shown, the others are cleared
+ *              when first switched to
  */
 void terminal_init() {
   int i;
   for (i = 0; i < NUM_TERMINALS; i++) {
-    terminals[i].video_buffer = (str)interactive_term_addr(i);
-    // Initialize the buffers
-    int j;
-    for (j = 0; j < NUM_COLS * NUM_ROWS; j++) {
-      terminals[i].video_buffer[j << 1] = ' ';
-      terminals[i].video_buffer[(j << 1) + 1] = ATTRIB;
-    }
-    for (j = 0; j < SIZE_INPUT_BUFFER; j++)
-      terminals[i].input_buffer[j] = 0;
-    // Initialize the states
-    terminals[i].buffer_pos = 0;    // Resets the buffer write head
-    terminals[i].read_complete = 0; // Resets the completion flag
-    // Initialize the cursor
-    terminals[i].cursor_x = 0;
-    terminals[i].cursor_y = 0;
+    terminals[i].video_buffer = NULL;
+    terminals[i].ready = 0;
     // Initialize the active process
     terminals[i].pid = NULL;
+    terminals[i].fg_pid = NULL;
   }
   foreground_terminal = 0; // Set first terminal active
   active_terminal = 0;
-  clear();
- switch_foreground_terminal(0, 0);
+  // Copying the blank buffer on screen clears it, no clear() needed
+  switch_foreground_terminal(0, 0);
+  boot_phase("terminal");
 }
 
 /* Switch to a different foreground terminal.
@@ -139,11 +190,14 @@ void switch_foreground_terminal(uint8_t target, uint8_t backup_current) {
   // Don't do this if asking to switch to the same terminal
   if (backup_current && target == foreground_terminal)
     return;
+  // Stay put if there is no memory for a new terminal
+  if (terminal_prepare(target))
+    return;
   // First map the video memory back to video to operate on it
-  switch_vid_address(VIDEO);
+  video_remap(VIDEO);
   if (backup_current) {
     terminal_t *old_term = &(terminals[foreground_terminal]);
-    memcpy(old_term->video_buffer, (char *)VIDEO,
+    fast_memcpy(old_term->video_buffer, (char *)VIDEO,
            NUM_COLS * NUM_ROWS * NUM_BITS_PER_PIXEL);
     //old_term->cursor_x = screen_x;
     //old_term->cursor_y = screen_y;
@@ -151,7 +205,7 @@ void switch_foreground_terminal(uint8_t target, uint8_t backup_current) {
   // Switch to current terminal
   foreground_terminal = target;
   terminal_t *new_term = &(terminals[target]);
-  memcpy((char *)VIDEO, new_term->video_buffer,
+  fast_memcpy((char *)VIDEO, new_term->video_buffer,
          NUM_COLS * NUM_ROWS * NUM_BITS_PER_PIXEL);
   screen_x = new_term->cursor_x;
   screen_y = new_term->cursor_y;
@@ -173,10 +227,10 @@ void set_terminal_vmem(uint8_t target) {
 	// Remap the video memory
 	  if (active_terminal == foreground_terminal) {
 		// Map physical video in
-		switch_vid_address(VIDEO);
+		video_remap(VIDEO);
 	  } else {
-		// Map one of the offscreen buffers
-		switch_vid_address(nonactive_terms[active_terminal]);
+		// Map the offscreen buffer, heap pages are identity mapped
+		video_remap((uint32_t)terminals[active_terminal].video_buffer);
 	  }
 	if (active_terminal == foreground_terminal) set_cursor();
 }
@@ -200,6 +254,7 @@ void backup_cursor(uint8_t target) {
  */
 void switch_active_terminal(uint8_t target) {
   if (target == active_terminal) {return;}
+  if (terminal_prepare(target)) {return;}
   previous_terminal = active_terminal;
   active_terminal = target;
   set_terminal_vmem(target);
@@ -212,8 +267,9 @@ void switch_active_terminal(uint8_t target) {
  * Side effect: Populates char to buffer if it fits.
  */
 uint8_t terminal_advance_buffer(terminal_t *term, char ch) {
-  cli();
+  uint32_t flags;
   uint8_t result = 1;
+  spin_lock_irqsave(&terminal_lock, flags);
   // CASE 1: If the buffer is complete, more keystrokes can screw it
   if (term->read_complete) {
     term->input_buffer[0] = 0; // Clear the string
@@ -228,6 +284,7 @@ uint8_t terminal_advance_buffer(terminal_t *term, char ch) {
     } else {
       result = 0;
     }
+    spin_unlock_irqrestore(&terminal_lock, flags);
     return result;
   }
   // CASE 3: Only add to buffer if input buffer is not full
@@ -240,9 +297,11 @@ uint8_t terminal_advance_buffer(terminal_t *term, char ch) {
     if (ch != '\n') result = 0;
   }
   // CASE 4: If the current char is newline, make it complete
-  if (ch == '\n')
+  if (ch == '\n') {
     term->read_complete = 1;
-  sti();
+    sched_wakeup(term);
+  }
+  spin_unlock_irqrestore(&terminal_lock, flags);
   return result;
 }
 
@@ -260,9 +319,13 @@ void terminal_handle_key(uint8_t key, uint8_t ctrl, uint8_t alt) {
   terminal_t *fg_term = &(terminals[foreground_terminal]);
   //terminal_t *active_term = &(terminals[active_terminal]);
   // BEGIN CP2.1
-  // Case 1: Ctrl+L: Clear screen and exit
+  // Case 1: Ctrl+L: Clear screen and exit, Ctrl+C: Interrupt the program
   if (ctrl) {
     switch (key) {
+    case 'c':
+    case 'C':
+      signal_raise(fg_term->fg_pid, SIG_INTERRUPT);  // Not its background jobs
+      break;
     case 'l':
       clear();
       break;
@@ -282,7 +345,7 @@ void terminal_handle_key(uint8_t key, uint8_t ctrl, uint8_t alt) {
       /* Following code is only used if scheduler is disabled. Only runs processes in the foreground
        * terminal, which is changed using ALT + F1-F3. Roughly the same as switch_active_terminal() */
       if (sched_enable != 1) {
-		switch_active_terminal(target_terminal);
+		irq_request_switch(target_terminal);  // called from a bottom half
         //previous_terminal = active_terminal;
         //active_terminal = target_terminal;
         //asm volatile ("call switch_process_debug"); // calls a dummy isr to simulate interrupt procedure
@@ -296,7 +359,7 @@ void terminal_handle_key(uint8_t key, uint8_t ctrl, uint8_t alt) {
   if ((key >= KEY_ACCEPTED_MIN && key <= KEY_ACCEPTED_MAX) || key == '\b') {
     // Before we putc: Make sure we map the screen
 	  set_terminal_vmem(foreground_terminal);
-    switch_vid_address(VIDEO);
+    video_remap(VIDEO);
     if(terminal_advance_buffer(fg_term, key)) {
 		putc(key);
 		backup_cursor(foreground_terminal);
@@ -1,25 +1,38 @@
 #pragma once
 
 #include "../lib.h"
+#include "../smp.h"
 
+/* Build with -DNUM_TERMINALS=n for more, Alt+F1 to Alt+F10 reach them.
+ * A terminal takes no memory or CPU time until it is first visited. */
+#ifndef NUM_TERMINALS
 #define NUM_TERMINALS 3
+#endif
+#define MAX_TERMINALS 10
+#if NUM_TERMINALS > MAX_TERMINALS
+#error "Only F1 to F10 can switch terminals"
+#endif
 #define SIZE_INPUT_BUFFER 128
+#define TERMINAL_WRITE_CHUNK 64  // Bytes written per interrupts-off stretch
 
 // BEGIN CP2.1
 typedef struct {
   uint8_t pid;  // PID of the current running process
+  uint8_t fg_pid;  // Leaf of the foreground chain, what Ctrl+C interrupts
   char input_buffer[SIZE_INPUT_BUFFER];
   // char video_buffer[NUM_COLS * NUM_ROWS * NUM_BITS_PER_PIXEL];
-  str video_buffer;
+  str video_buffer;  // Heap page, identity mapped, allocated on first visit
   uint8_t buffer_pos;
   uint8_t read_complete; // Flippped to 1 when a newline is read
   uint8_t cursor_x;
   uint8_t cursor_y;
+  uint8_t ready;  // Visited: has a buffer, and the scheduler runs it
 } terminal_t;
 
 extern int foreground_terminal;
-extern int active_terminal;
-extern int previous_terminal;
+/* Each CPU runs the processes of its own terminals, see smp_terminal_cpu */
+#define active_terminal (smp_this_cpu()->terminal)
+#define previous_terminal (smp_this_cpu()->prev_terminal)
 extern terminal_t terminals[NUM_TERMINALS];
 
 // syscall methods
@@ -32,6 +45,8 @@ int32_t terminal_close(int32_t fd);
 void terminal_init();
 void switch_foreground_terminal(uint8_t target, uint8_t backup_current);
 void switch_active_terminal(uint8_t target);
+void set_terminal_vmem(uint8_t target);
+int32_t terminal_prepare(uint8_t target);
 void terminal_handle_key(uint8_t key, uint8_t ctrl, uint8_t alt);
 
 // END CP2.1
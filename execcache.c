@@ -0,0 +1,140 @@
+#include "execcache.h"
+#include "filesystem.h"
+#include "fsext.h"
+#include "lib.h"
+#include "fastmem.h"
+#include "spinlock.h"
+#include "interrupt/process.h"
+
+/* The image shares the 4MB user page with the stack at its top */
+#define EXEC_MAX_IMAGE (PROCESS_START_LOCATION + 0x400000 - PROCESS_LD_LOCATION)
+
+static exec_image_t exec_cache[EXEC_CACHE_SIZE];
+static uint32_t exec_cache_clock;
+static uint32_t exec_cache_misses;
+
+/* Guards exec_cache, never held across a filesystem read */
+static spinlock_t exec_cache_lock = SPINLOCK_INIT;
+
+/* Slot holding inode, or NULL. Call with exec_cache_lock held. */
+static exec_image_t* exec_cache_find(uint32_t inode) {
+    uint32_t i;
+    for (i = 0; i < EXEC_CACHE_SIZE; i++) {
+        if (exec_cache[i].name[0] && exec_cache[i].inode == inode)
+            return &exec_cache[i];
+    }
+    return NULL;
+}
+
+/* Empty slot if there is one, else the least recently used */
+static exec_image_t* exec_cache_victim() {
+    exec_image_t* victim = &exec_cache[0];
+    uint32_t i;
+    for (i = 0; i < EXEC_CACHE_SIZE; i++) {
+        if (!exec_cache[i].name[0]) return &exec_cache[i];
+        if (exec_cache[i].last_used < victim->last_used)
+            victim = &exec_cache[i];
+    }
+    return victim;
+}
+
+/* Walks the inode's block list or extents once and keeps the runs. Leaves
+ * num_runs at 0 when there are too many runs or a block number is bad. */
+static void exec_cache_map_blocks(exec_image_t* image) {
+    uint32_t num_blocks = (image->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t file_block, runs = 0;
+    fsext_extent_t run;
+    image->num_runs = 0;
+    for (file_block = 0; file_block < num_blocks; file_block += run.count) {
+        if (runs == EXEC_CACHE_MAX_RUNS) return;
+        if (fsext_run(image->inode, file_block, &run)) return;
+        image->runs[runs].block = run.block;
+        image->runs[runs].count = run.count;
+        runs++;
+    }
+    image->num_runs = runs;
+}
+
+int32_t exec_cache_lookup(const int8_t* name, exec_image_t* image) {
+    uint8_t header[PROCESS_HEADER_BLOCK_LENGTH];
+    exec_image_t* slot;
+    dentry_t dentry;
+    uint32_t flags;
+
+    // The directory decides which file a name is, the cache what it holds
+    if (read_dentry_by_name((str)name, &dentry) == -1) return -1;
+    spin_lock_irqsave(&exec_cache_lock, flags);
+    slot = exec_cache_find(dentry.inode_num);
+    if (slot) {
+        slot->hits++;
+        slot->last_used = ++exec_cache_clock;
+        memcpy(image, slot, sizeof(exec_image_t));
+    } else {
+        exec_cache_misses++;
+    }
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+    if (slot) return 0;
+
+    // Cold: the header checks execute used to do each time
+    if (fsext_read(dentry.inode_num, 0, header, sizeof(header)) != sizeof(header))
+        return -1;
+    if (*((uint32_t*)header) != EXECUTABLE_MAGIC) return -1;
+    fast_strncpy(image->name, name, EXEC_NAME_LENGTH - 1);
+    image->name[EXEC_NAME_LENGTH - 1] = 0;
+    image->inode = dentry.inode_num;
+    image->entry = *((uint32_t*)(header + PROCESS_EIP_LOCATION));
+    image->length = fsext_length(dentry.inode_num);
+    if (image->length > EXEC_MAX_IMAGE) return -1;
+    exec_cache_map_blocks(image);
+    image->hits = 0;
+
+    // Another execute may have filled the same inode in the meantime
+    spin_lock_irqsave(&exec_cache_lock, flags);
+    slot = exec_cache_find(image->inode);
+    if (!slot) {
+        slot = exec_cache_victim();
+        memcpy(slot, image, sizeof(exec_image_t));
+    }
+    slot->last_used = ++exec_cache_clock;
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+    return 0;
+}
+
+int32_t exec_cache_load(const exec_image_t* image, uint8_t* dest) {
+    uint32_t i, size, left = image->length;
+    if (!image->num_runs)
+        return fsext_read(image->inode, 0, dest, image->length);
+    for (i = 0; i < image->num_runs && left; i++) {
+        size = image->runs[i].count * BLOCK_SIZE;
+        if (size > left) size = left;
+        fast_memcpy(dest, fsext_block(image->runs[i].block), size);
+        dest += size;
+        left -= size;
+    }
+    return image->length;
+}
+
+void exec_cache_flush() {
+    uint32_t flags;
+    spin_lock_irqsave(&exec_cache_lock, flags);
+    memset(exec_cache, 0, sizeof(exec_cache));
+    exec_cache_misses = 0;
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+}
+
+void exec_cache_info(procfs_out_t* out) {
+    uint32_t i;
+    procfs_puts(out, "misses ");
+    procfs_putu(out, exec_cache_misses, 0);
+    procfs_puts(out, "\nINODE     BYTES  RUNS      HITS NAME\n");
+    for (i = 0; i < EXEC_CACHE_SIZE; i++) {
+        if (!exec_cache[i].name[0]) continue;
+        procfs_putu(out, exec_cache[i].inode, 5);
+        procfs_putu(out, exec_cache[i].length, 10);
+        procfs_putu(out, exec_cache[i].num_runs, 6);
+        procfs_putu(out, exec_cache[i].hits, 10);
+        procfs_puts(out, " ");
+        procfs_puts(out, exec_cache[i].name);
+        procfs_puts(out, "\n");
+    }
+}
@@ -0,0 +1,56 @@
+/* execcache.h - Executable metadata cached per inode for execute
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _EXECCACHE_H
+#define _EXECCACHE_H
+
+#include "types.h"
+#include "driver/procfs.h"
+
+#define EXEC_CACHE_SIZE 8
+#define EXEC_NAME_LENGTH 33  /* Filesystem names are up to 32 chars */
+/* Contiguous runs of data blocks kept per image. A file split into more
+ * pieces than this is loaded through read_data instead. */
+#define EXEC_CACHE_MAX_RUNS 16
+
+#ifndef ASM
+
+typedef struct {
+    uint32_t block;  /* Data block number */
+    uint32_t count;
+} exec_run_t;
+
+/* What execute needs from an executable once its header checked out. The
+ * boot filesystem is read only, so an entry never goes stale. */
+typedef struct {
+    int8_t name[EXEC_NAME_LENGTH];
+    uint32_t inode;
+    uint32_t entry;      /* EIP from the header */
+    uint32_t length;     /* Image size in bytes */
+    uint32_t num_runs;   /* 0: too fragmented, use read_data */
+    exec_run_t runs[EXEC_CACHE_MAX_RUNS];
+    uint32_t hits;
+    uint32_t last_used;  /* For LRU replacement */
+} exec_image_t;
+
+/* Looks the name up in the directory, then finds the executable's inode
+ * in the cache. A miss validates the magic and entry point and fills a
+ * slot. The entry is copied out since a concurrent execute may reuse the
+ * slot.
+ * Returns 0 on success, -1 if the file is missing or not executable. */
+int32_t exec_cache_lookup(const int8_t* name, exec_image_t* image);
+
+/* Copies the image to dest, one memcpy per run of consecutive blocks.
+ * Returns the number of bytes loaded, or -1. */
+int32_t exec_cache_load(const exec_image_t* image, uint8_t* dest);
+
+/* Drops every entry, so the next lookups are cold */
+void exec_cache_flush(void);
+
+/* proc/execcache */
+void exec_cache_info(procfs_out_t* out);
+
+#endif /* ASM */
+
+#endif /* _EXECCACHE_H */
@@ -0,0 +1,104 @@
+#include "fastmem.h"
+#include "interrupt/fpu.h"
+
+/* Copies whole 64 byte blocks. Both pointers must be 16 byte aligned.
+ * The kernel is built without SSE, so nothing else lives in xmm0-3. */
+static void sse_copy(uint8_t* d, const uint8_t* s, uint32_t n) {
+    uint32_t flags = kernel_fpu_begin();
+    for (; n; n -= FASTMEM_SSE_BLOCK, d += FASTMEM_SSE_BLOCK, s += FASTMEM_SSE_BLOCK) {
+        asm volatile(
+            "movdqa (%0), %%xmm0\n"
+            "movdqa 16(%0), %%xmm1\n"
+            "movdqa 32(%0), %%xmm2\n"
+            "movdqa 48(%0), %%xmm3\n"
+            "movdqa %%xmm0, (%1)\n"
+            "movdqa %%xmm1, 16(%1)\n"
+            "movdqa %%xmm2, 32(%1)\n"
+            "movdqa %%xmm3, 48(%1)\n"
+            :
+            : "r"(s), "r"(d)
+            : "memory");
+    }
+    kernel_fpu_end(flags);
+}
+
+/**
+ * Copies n bytes.
+ * INPUT: dest, src: Non overlapping buffers, n: Byte count
+ * OUTPUT: dest
+ * EFFECT: Short copies are open coded, medium ones use rep movsl with the
+ *         destination dword aligned, large 16 byte aligned ones use SSE2.
+ */
+void* fast_memcpy(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    uint32_t bulk;
+    if (n < FASTMEM_SMALL) {
+        for (; n >= 4; n -= 4, d += 4, s += 4)
+            *(uint32_t*)d = *(const uint32_t*)s;
+        while (n--) *d++ = *s++;
+        return dest;
+    }
+    if (n >= FASTMEM_SSE_MIN && !(((uint32_t)d | (uint32_t)s) & 0xF)) {
+        bulk = n & ~(FASTMEM_SSE_BLOCK - 1);
+        sse_copy(d, s, bulk);
+        d += bulk;
+        s += bulk;
+        n -= bulk;
+    }
+    // Unaligned stores are what hurts, so line up the destination
+    while (n && ((uint32_t)d & 3)) {
+        *d++ = *s++;
+        n--;
+    }
+    bulk = n >> 2;
+    asm volatile("cld; rep movsl"
+                 : "+D"(d), "+S"(s), "+c"(bulk)
+                 :
+                 : "memory");
+    for (n &= 3; n; n--) *d++ = *s++;
+    return dest;
+}
+
+/**
+ * Fills n bytes with c.
+ * INPUT: s: Buffer, c: Byte value, n: Byte count
+ * OUTPUT: s
+ */
+void* fast_memset(void* s, int32_t c, uint32_t n) {
+    uint8_t* d = (uint8_t*)s;
+    uint32_t pattern = (uint8_t)c * 0x01010101;
+    uint32_t bulk;
+    if (n < FASTMEM_SMALL) {
+        for (; n >= 4; n -= 4, d += 4)
+            *(uint32_t*)d = pattern;
+        while (n--) *d++ = (uint8_t)c;
+        return s;
+    }
+    while ((uint32_t)d & 3) {
+        *d++ = (uint8_t)c;
+        n--;
+    }
+    bulk = n >> 2;
+    asm volatile("cld; rep stosl"
+                 : "+D"(d), "+c"(bulk)
+                 : "a"(pattern)
+                 : "memory");
+    for (n &= 3; n; n--) *d++ = (uint8_t)c;
+    return s;
+}
+
+/**
+ * strncpy: copies src up to its terminator and zero fills the rest of n.
+ * INPUT: dest, src: Strings, n: Size of dest
+ * OUTPUT: dest
+ * EFFECT: Only the length scan is bytewise, the copy and the padding go
+ *         through fast_memcpy and fast_memset.
+ */
+int8_t* fast_strncpy(int8_t* dest, const int8_t* src, uint32_t n) {
+    uint32_t len = 0;
+    while (len < n && src[len]) len++;
+    fast_memcpy(dest, src, len);
+    fast_memset(dest + len, 0, n - len);
+    return dest;
+}
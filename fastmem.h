@@ -0,0 +1,26 @@
+/* fastmem.h - Size dispatched memcpy, memset and strncpy for hot paths
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _FASTMEM_H
+#define _FASTMEM_H
+
+#include "types.h"
+
+/* Below this, plain dword and byte moves beat setting up a string op */
+#define FASTMEM_SMALL 16
+/* From here on an SSE2 copy pays for saving the owner's FPU state */
+#define FASTMEM_SSE_MIN 0x4000
+#define FASTMEM_SSE_BLOCK 64  /* Four xmm registers per iteration */
+
+#ifndef ASM
+
+/* Same contracts as memcpy, memset and strncpy in lib.c.
+ * fast_memcpy's regions must not overlap. */
+void* fast_memcpy(void* dest, const void* src, uint32_t n);
+void* fast_memset(void* s, int32_t c, uint32_t n);
+int8_t* fast_strncpy(int8_t* dest, const int8_t* src, uint32_t n);
+
+#endif /* ASM */
+
+#endif /* _FASTMEM_H */
@@ -0,0 +1,179 @@
+#include "fsext.h"
+#include "filesystem.h"
+#include "fastmem.h"
+#include "uaccess.h"
+#include "buddy.h"
+#include "tlb.h"
+#include "interrupt/process.h"
+
+#define FSEXT_PAGE_SHIFT 22
+#define FSEXT_PAGE_FLAGS 0x83  /* Present, R/W, 4MB, kernel only */
+
+/* The boot block starts with the directory entry, inode and data block
+ * counts, the inode blocks follow it and the data blocks follow them */
+#define FSEXT_IMAGE ((uint32_t*)boot_block)
+#define FSEXT_NUM_INODES (FSEXT_IMAGE[1])
+#define FSEXT_NUM_DATA_BLOCKS (FSEXT_IMAGE[2])
+#define FSEXT_INODE(inode) \
+    ((fsext_inode_t*)((uint8_t*)boot_block + (1 + (inode)) * FSEXT_BLOCK_SIZE))
+
+/* Where a walk over the extents got to, so a read spanning several runs
+ * doesn't start over from the first extent for each one */
+typedef struct {
+    uint32_t index;  /* Next extent to look at */
+    uint32_t base;   /* File block it starts at */
+} fsext_cursor_t;
+
+extern uint32_t pgDir[];
+
+/* Boot modules fsext_init mapped */
+static uint8_t fsext_module_ok[BUDDY_MAX_MODULES];
+/* Image fsext_image_ok last looked at, and what it found */
+static const void* fsext_checked;
+static int32_t fsext_fits;
+
+void fsext_init() {
+    uint32_t i, pde;
+    for (i = 0; i < boot_num_modules; i++) {
+        fsext_module_ok[i] = 0;
+        if (boot_modules[i].end <= boot_modules[i].start ||
+            boot_modules[i].start < (KERNEL_PDE_INDEX << FSEXT_PAGE_SHIFT) ||
+            boot_modules[i].end > PROCESS_START_LOCATION)
+            continue;
+        for (pde = boot_modules[i].start >> FSEXT_PAGE_SHIFT;
+             pde <= (boot_modules[i].end - 1) >> FSEXT_PAGE_SHIFT; pde++) {
+            if (!(pgDir[pde] & PAGE_PRESENT))
+                pgDir[pde] = (pde << FSEXT_PAGE_SHIFT) | FSEXT_PAGE_FLAGS | PAGE_GLOBAL;
+        }
+        fsext_module_ok[i] = 1;
+    }
+}
+
+/* An image loaded as a boot module has to be mapped and hold every block
+ * its boot block counts. One anywhere else, like the tests' in kernel
+ * memory, is taken as it is. */
+static int32_t fsext_image_ok() {
+    uint32_t start = (uint32_t)boot_block, blocks, i;
+    if ((const void*)boot_block == fsext_checked) return fsext_fits;
+    fsext_checked = boot_block;
+    fsext_fits = 1;
+    for (i = 0; i < boot_num_modules; i++) {
+        if (start < boot_modules[i].start || start >= boot_modules[i].end) continue;
+        blocks = (boot_modules[i].end - start) / FSEXT_BLOCK_SIZE;
+        fsext_fits = fsext_module_ok[i] && FSEXT_NUM_INODES < blocks &&
+                     FSEXT_NUM_DATA_BLOCKS <= blocks - 1 - FSEXT_NUM_INODES;
+    }
+    return fsext_fits;
+}
+
+/* Address of a data block */
+uint8_t* fsext_block(uint32_t block) {
+    return (uint8_t*)boot_block + (1 + FSEXT_NUM_INODES + block) * FSEXT_BLOCK_SIZE;
+}
+
+static int32_t fsext_blocks_ok(uint32_t block, uint32_t count) {
+    return block < FSEXT_NUM_DATA_BLOCKS && count <= FSEXT_NUM_DATA_BLOCKS - block;
+}
+
+static int32_t fsext_extended(fsext_inode_t* node) {
+    return FSEXT_IMAGE[FSEXT_IMAGE_MAGIC_WORD] == FSEXT_IMAGE_MAGIC &&
+           node->magic == FSEXT_INODE_MAGIC;
+}
+
+/* Extent number index, from the inode or an indirect block */
+static fsext_extent_t* fsext_extent(fsext_inode_t* node, uint32_t index) {
+    uint32_t block;
+    if (index < FSEXT_INLINE_EXTENTS) return &node->extents[index];
+    index -= FSEXT_INLINE_EXTENTS;
+    block = node->indirect[index / FSEXT_EXTENTS_PER_BLOCK];
+    if (!fsext_blocks_ok(block, 1)) return NULL;
+    return (fsext_extent_t*)fsext_block(block) + index % FSEXT_EXTENTS_PER_BLOCK;
+}
+
+/* Flat inode: the block list follows the length, runs are merged here */
+static int32_t fsext_flat_run(fsext_inode_t* node, uint32_t file_block,
+                              uint32_t num_blocks, fsext_extent_t* run) {
+    uint32_t* blocks = (uint32_t*)node + 1;
+    if (num_blocks > FSEXT_FLAT_BLOCKS) return -1;
+    run->block = blocks[file_block];
+    run->count = 1;
+    while (file_block + run->count < num_blocks &&
+           blocks[file_block + run->count] == run->block + run->count)
+        run->count++;
+    return fsext_blocks_ok(run->block, run->count) ? 0 : -1;
+}
+
+static int32_t fsext_find(uint32_t inode, uint32_t file_block,
+                          fsext_cursor_t* cursor, fsext_extent_t* run) {
+    fsext_inode_t* node = FSEXT_INODE(inode);
+    fsext_extent_t* extent;
+    uint32_t num_blocks = (node->length + FSEXT_BLOCK_SIZE - 1) / FSEXT_BLOCK_SIZE;
+    if (file_block >= num_blocks) return -1;
+    if (!fsext_extended(node))
+        return fsext_flat_run(node, file_block, num_blocks, run);
+    if (node->num_extents > FSEXT_MAX_EXTENTS) return -1;
+    if (file_block < cursor->base) cursor->index = cursor->base = 0;
+    for (; cursor->index < node->num_extents; cursor->index++) {
+        extent = fsext_extent(node, cursor->index);
+        if (!extent || !fsext_blocks_ok(extent->block, extent->count)) return -1;
+        if (file_block - cursor->base < extent->count) {
+            run->block = extent->block + (file_block - cursor->base);
+            run->count = extent->count - (file_block - cursor->base);
+            return 0;
+        }
+        cursor->base += extent->count;
+    }
+    return -1;
+}
+
+int32_t fsext_length(uint32_t inode) {
+    if (!fsext_image_ok() || inode >= FSEXT_NUM_INODES) return -1;
+    return FSEXT_INODE(inode)->length;
+}
+
+int32_t fsext_run(uint32_t inode, uint32_t file_block, fsext_extent_t* run) {
+    fsext_cursor_t cursor = {0, 0};
+    if (!fsext_image_ok() || inode >= FSEXT_NUM_INODES) return -1;
+    return fsext_find(inode, file_block, &cursor, run);
+}
+
+/* Shared by fsext_read and fsext_file_read. For a user buffer a fault
+ * ends the read early, like a short read. */
+static int32_t fsext_copy(uint32_t inode, uint32_t offset, uint8_t* buf,
+                          uint32_t length, int32_t user) {
+    fsext_cursor_t cursor = {0, 0};
+    fsext_extent_t run;
+    uint32_t skip, size, left, done = 0;
+    int32_t file_length = fsext_length(inode);
+    if (file_length == -1) return -1;
+    if (offset >= (uint32_t)file_length) return 0;
+    if (length > file_length - offset) length = file_length - offset;
+    while (done < length) {
+        if (fsext_find(inode, (offset + done) / FSEXT_BLOCK_SIZE, &cursor, &run))
+            return -1;
+        skip = (offset + done) % FSEXT_BLOCK_SIZE;
+        size = length - done;
+        if (run.count < (size + skip + FSEXT_BLOCK_SIZE - 1) / FSEXT_BLOCK_SIZE)
+            size = run.count * FSEXT_BLOCK_SIZE - skip;
+        if (user) {
+            left = __copy_user(buf + done, fsext_block(run.block) + skip, size);
+            if (left) {
+                done += size - left;
+                return done ? done : -1;
+            }
+        } else {
+            fast_memcpy(buf + done, fsext_block(run.block) + skip, size);
+        }
+        done += size;
+    }
+    return done;
+}
+
+int32_t fsext_read(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
+    return fsext_copy(inode, offset, buf, length, 0);
+}
+
+int32_t fsext_file_read(int32_t inode, void* buf, int32_t nbytes, int32_t offset) {
+    if (nbytes < 0 || offset < 0) return -1;
+    return fsext_copy(inode, offset, buf, nbytes, 1);
+}
@@ -0,0 +1,80 @@
+/* fsext.h - Extended inodes: extents and indirect blocks for large files
+ * vim:ts=4 noexpandtab
+ *
+ * A flat inode is a length followed by 1023 data block numbers, which caps
+ * a file at 4MB. An extended inode keeps the length in the same place,
+ * puts FSEXT_INODE_MAGIC where the first block number would be, and then
+ * describes the file as extents: runs of consecutive data blocks, in file
+ * order. The first FSEXT_INLINE_EXTENTS live in the inode, the rest in up
+ * to FSEXT_INDIRECT indirect blocks of FSEXT_EXTENTS_PER_BLOCK each.
+ *
+ * Extended inodes are only honoured on images whose boot block carries
+ * FSEXT_IMAGE_MAGIC in its first reserved word. Images without it, and
+ * flat inodes on images with it, read exactly as before.
+ */
+
+#ifndef _FSEXT_H
+#define _FSEXT_H
+
+#include "types.h"
+
+#define FSEXT_BLOCK_SIZE 4096  /* Same as BLOCK_SIZE in filesystem.h */
+#define FSEXT_FLAT_BLOCKS 1023  /* Block numbers in a flat inode */
+
+/* Boot block word 3, right after the three counts */
+#define FSEXT_IMAGE_MAGIC_WORD 3
+#define FSEXT_IMAGE_MAGIC 0x31545845  /* "EXT1" */
+/* Far above any data block count an image could have */
+#define FSEXT_INODE_MAGIC 0x54584549  /* "IEXT" */
+
+#define FSEXT_INDIRECT 8
+#define FSEXT_INLINE_EXTENTS 506
+#define FSEXT_EXTENTS_PER_BLOCK (FSEXT_BLOCK_SIZE / 8)
+#define FSEXT_MAX_EXTENTS \
+    (FSEXT_INLINE_EXTENTS + FSEXT_INDIRECT * FSEXT_EXTENTS_PER_BLOCK)
+
+#ifndef ASM
+
+/* count data blocks starting at block. Also used to hand out runs of a
+ * flat inode, where consecutive block numbers are merged on the fly. */
+typedef struct {
+    uint32_t block;
+    uint32_t count;
+} fsext_extent_t;
+
+/* Fills one 4kB inode block */
+typedef struct {
+    uint32_t length;
+    uint32_t magic;
+    uint32_t num_extents;
+    uint32_t indirect[FSEXT_INDIRECT];
+    fsext_extent_t extents[FSEXT_INLINE_EXTENTS];
+    uint32_t reserved;
+} fsext_inode_t;
+
+/* Maps the boot modules above the kernel page, 4MB pages up to the user
+ * page at 128MB. A module too high to map is refused: an image in it
+ * reads as empty. Called by init_pcb before smp_init, so the APs' page
+ * directories get the mappings as well. */
+void fsext_init(void);
+
+/* Address of a data block in the loaded image */
+uint8_t* fsext_block(uint32_t block);
+
+/* File size in bytes, or -1 for a bad inode number */
+int32_t fsext_length(uint32_t inode);
+
+/* The run of consecutive data blocks holding file block file_block and
+ * what follows it. Returns 0, or -1 past the end or on a corrupt inode. */
+int32_t fsext_run(uint32_t inode, uint32_t file_block, fsext_extent_t* run);
+
+/* read_data for both inode formats, into a kernel buffer. One copy per
+ * run of consecutive blocks. Returns bytes read, 0 at the end, or -1. */
+int32_t fsext_read(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
+
+/* Regular file read for the read syscall, copies with __copy_user */
+int32_t fsext_file_read(int32_t inode, void* buf, int32_t nbytes, int32_t offset);
+
+#endif /* ASM */
+
+#endif /* _FSEXT_H */
@@ -6,7 +6,12 @@
 #include "../lib.h"
 #include "../driver/terminal.h"
 #include "../driver/rtc.h"
+#include "../driver/pipe.h"
+#include "../driver/procfs.h"
+#include "../driver/serial.h"
+#include "../uaccess.h"
 #include "../filesystem.h"
+#include "../fsext.h"
 
 typedef int32_t (*func_open)(const str);
 typedef int32_t (*func_write)(int32_t, const void*, int32_t);
@@ -14,10 +19,10 @@ typedef int32_t (*func_read)(int32_t, void*, int32_t, int32_t);
 typedef int32_t (*func_close)(int32_t);
 
 
-func_open drivers_open[DRIVER_COUNT] = {terminal_open, rtc_open, file_open, directory_open};
-func_close drivers_close[DRIVER_COUNT] = {terminal_close, rtc_close, file_close, directory_close};
-func_read drivers_read[DRIVER_COUNT] = {terminal_read, rtc_read, file_read, directory_read};
-func_write drivers_write[DRIVER_COUNT] = {terminal_write, rtc_write, file_write, directory_write};
+func_open drivers_open[DRIVER_COUNT] = {terminal_open, rtc_open, file_open, directory_open, pipe_open, pipe_open, procfs_open, serial_open};
+func_close drivers_close[DRIVER_COUNT] = {terminal_close, rtc_close, file_close, directory_close, pipe_read_close, pipe_write_close, procfs_close, serial_close};
+func_read drivers_read[DRIVER_COUNT] = {terminal_read, rtc_read, fsext_file_read, directory_read, pipe_read, pipe_bad_read, procfs_read, serial_read};
+func_write drivers_write[DRIVER_COUNT] = {terminal_write, rtc_write, file_write, directory_write, pipe_bad_write, pipe_write, procfs_write, serial_write};
 
 
 int32_t read(int32_t fd, void *buf, int32_t nbytes) {
@@ -26,7 +31,9 @@ int32_t read(int32_t fd, void *buf, int32_t nbytes) {
     if (fd == FD_STDOUT) return -1;
     file_descriptor_t* descriptor = &(processes[terminals[active_terminal].pid]->file_descriptors[fd]);
     if (!descriptor->flags) return -1;  // Not in use
-    // STEP 2: Call the driver
+    // STEP 2: Drivers copy with __copy_user, only the range is checked here
+    if (nbytes > 0 && !user_range_ok(buf, nbytes)) return -1;
+    // STEP 3: Call the driver
     // TODO: Plan the rest for the FS.
     int32_t bytes_read = drivers_read[descriptor->operations_table](
         descriptor->inode, buf, nbytes, descriptor->position);
@@ -40,17 +47,26 @@ int32_t write(int32_t fd, const void *buf, int32_t nbytes) {
     if (fd == FD_STDIN) return -1;
     file_descriptor_t descriptor = processes[terminals[active_terminal].pid]->file_descriptors[fd];
     if (!descriptor.flags) return -1;  // Not in use
-    // STEP 2: Call the driver
+    // STEP 2: Drivers copy with __copy_user, only the range is checked here
+    if (nbytes > 0 && !user_range_ok(buf, nbytes)) return -1;
+    // STEP 3: Call the driver
     // TODO: Plan the rest for the FS.
     return drivers_write[descriptor.operations_table](descriptor.inode, buf, nbytes);
 }
 
-int32_t open(const str filename) {
-    int32_t result, fd;
+int32_t open(const str user_filename) {
+    int32_t result, fd, proc_index, is_serial;
     dentry_t curr_dentry;
+    int8_t filename[SIZE_INPUT_BUFFER];
 
+    // Everything below reads the name, so it reads a copy that can't fault
+    if (strncpy_from_user(filename, user_filename, sizeof(filename)) < 0) return -1;
+    // Pseudo-files and devices aren't on the filesystem, check them first
+    proc_index = procfs_lookup(filename);
+    is_serial = !strncmp(filename, SERIAL_DEVICE_NAME, sizeof(SERIAL_DEVICE_NAME));
     //find the dentry, error if not found
-    if (read_dentry_by_name(filename, &curr_dentry) == -1) {return -1;}
+    if (proc_index == -1 && !is_serial &&
+        read_dentry_by_name(filename, &curr_dentry) == -1) {return -1;}
     // Search for a file descriptor
     for (fd = FD_STDOUT+1; fd < NUM_FILE_DESCRIPTORS; fd++) {
         if (!processes[terminals[active_terminal].pid]->file_descriptors[fd].flags) {
@@ -58,7 +74,13 @@ int32_t open(const str filename) {
             target_fdesc->flags = 1;
             target_fdesc->position = 0;
             uint32_t driver_type;
-            switch (curr_dentry.file_type)
+            if (proc_index != -1) {
+                driver_type = DRIVER_PROC;
+                curr_dentry.inode_num = proc_index;
+            } else if (is_serial) {
+                driver_type = DRIVER_SERIAL;
+                curr_dentry.inode_num = 0;
+            } else switch (curr_dentry.file_type)
             {
                 case RTC_FILE_TYPE: driver_type = DRIVER_RTC; break;
                 case DIR_FILE_TYPE: driver_type = DRIVER_DIR; break;
@@ -91,8 +113,50 @@ int32_t close(int32_t fd) {
 }
 
 int32_t getargs(str buf, int32_t nbytes) {
-    if (!buf) return -1;
-    if (!nbytes) return -1;
-    strncpy(buf, processes[terminals[active_terminal].pid]->args, nbytes);
+    uint8_t pid = terminals[active_terminal].pid;
+    str args;
+    uint32_t len;
+    // No process (kernel context) or a bad buffer: don't touch the PCB
+    if (!pid || nbytes <= 0 || !user_range_ok(buf, nbytes)) return -1;
+    args = processes[pid]->args;
+    len = strlen(args) + 1;
+    // Terminator included, cut short like strncpy if it doesn't fit
+    if (len > (uint32_t)nbytes) len = nbytes;
+    return copy_to_user(buf, args, len);
+}
+
+/**
+ * Creates a pipe and opens both of its ends in the current process.
+ * INPUT: fds: Array of two ints. fds[0] receives the read end,
+ *             fds[1] the write end.
+ * OUTPUT: 0 on success, -1 if out of descriptors or pipes
+ */
+int32_t pipe(int32_t *fds) {
+    int32_t fd, index, found = 0;
+    int32_t ends[2];
+    pcb_t* pcb = processes[terminals[active_terminal].pid];
+    if (!user_range_ok(fds, sizeof(ends))) return -1;
+    // STEP 1: Find two free descriptors before committing to anything
+    for (fd = FD_STDOUT+1; fd < NUM_FILE_DESCRIPTORS && found < 2; fd++) {
+        if (!pcb->file_descriptors[fd].flags) ends[found++] = fd;
+    }
+    if (found < 2) return -1;
+    // STEP 2: Grab a pipe
+    index = pipe_create();
+    if (index == -1) return -1;
+    // STEP 3: Hook both ends to it
+    pcb->file_descriptors[ends[0]].operations_table = DRIVER_PIPE_READ;
+    pcb->file_descriptors[ends[1]].operations_table = DRIVER_PIPE_WRITE;
+    for (found = 0; found < 2; found++) {
+        pcb->file_descriptors[ends[found]].inode = index;
+        pcb->file_descriptors[ends[found]].position = 0;
+        pcb->file_descriptors[ends[found]].flags = 1;
+    }
+    if (copy_to_user(fds, ends, sizeof(ends))) {
+        // Nowhere to report the descriptors, so don't leave them open
+        close(ends[0]);
+        close(ends[1]);
+        return -1;
+    }
     return 0;
 }
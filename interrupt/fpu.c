@@ -0,0 +1,131 @@
+/**
+ * Lazy FPU switching.
+ * Integer-only processes never take the trap, so they never pay for a
+ * 512 byte save and restore.
+ */
+#include "fpu.h"
+#include "process.h"
+#include "../lib.h"
+#include "../driver/terminal.h"
+#include "../smp.h"
+#include "../irqoff.h"
+
+#define MXCSR_DEFAULT 0x1F80  /* All SSE exceptions masked */
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+    asm volatile("movl %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static inline void set_ts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+/**
+ * Enables the FPU and FXSAVE/SSE.
+ * INPUT: None
+ * OUTPUT: None
+ */
+void fpu_init() {
+    uint32_t cr4;
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("movl %0, %%cr4" : : "r"(cr4));
+    fpu_owner = 0;
+    set_ts();
+}
+
+/**
+ * Arms the trap unless the incoming process already owns the registers.
+ * INPUT: pid: Process about to run
+ * OUTPUT: None
+ */
+void fpu_switch(uint8_t pid) {
+    if (pid && pid == fpu_owner) asm volatile("clts");
+    else set_ts();
+}
+
+/**
+ * Drops ownership for a halting process, its registers are garbage now.
+ * INPUT: pid: The process
+ * OUTPUT: None
+ */
+void fpu_release(uint8_t pid) {
+    if (fpu_owner == pid) {
+        fpu_owner = 0;
+        set_ts();
+    }
+}
+
+/**
+ * Saves the registers of a terminal's process if this CPU's FPU holds
+ * them, before sched_balance hands the terminal to another CPU.
+ * INPUT: terminal: Terminal about to move
+ * OUTPUT: None
+ * EFFECT: Call with interrupts off. The other CPU reloads them from the
+ *         PCB on the process's first FPU instruction there.
+ */
+void fpu_save_terminal(int32_t terminal) {
+    if (!fpu_owner || processes[fpu_owner]->terminal != terminal) return;
+    asm volatile("clts");
+    asm volatile("fxsave %0" : "=m"(processes[fpu_owner]->fpu_state));
+    fpu_owner = 0;
+    set_ts();
+}
+
+/**
+ * Handles #NM: saves the owner's registers and loads the running process's.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: A process that never used the FPU starts from a clean state.
+ */
+void fpu_handle_trap() {
+    uint8_t pid = terminals[active_terminal].pid;
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    asm volatile("clts");
+    if (pid == fpu_owner) return;
+    if (fpu_owner)
+        asm volatile("fxsave %0" : "=m"(processes[fpu_owner]->fpu_state));
+    if (pid && processes[pid]->fpu_used) {
+        asm volatile("fxrstor %0" : : "m"(processes[pid]->fpu_state));
+    } else {
+        asm volatile("fninit; ldmxcsr %0" : : "m"(mxcsr));
+    }
+    if (pid) processes[pid]->fpu_used = 1;
+    fpu_owner = pid;
+}
+
+/**
+ * Hands the FPU to the kernel.
+ * INPUT: None
+ * OUTPUT: Saved flags, pass them to kernel_fpu_end
+ * EFFECT: Interrupts off so that no switch sets TS under our feet.
+ */
+uint32_t kernel_fpu_begin() {
+    uint32_t flags;
+    irqoff_save(flags);
+    asm volatile("clts");
+    // The owner runs on this CPU, fpu_save_terminal empties it before
+    // the owner's terminal moves
+    if (fpu_owner) {
+        asm volatile("fxsave %0" : "=m"(processes[fpu_owner]->fpu_state));
+        fpu_owner = 0;
+    }
+    return flags;
+}
+
+/**
+ * Gives the FPU back. Nobody owns it now, the next user trap reloads.
+ * INPUT: flags: From kernel_fpu_begin
+ * OUTPUT: None
+ */
+void kernel_fpu_end(uint32_t flags) {
+    set_ts();
+    irqoff_restore(flags);
+}
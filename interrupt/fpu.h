@@ -0,0 +1,43 @@
+/**
+ * Lazy x87/SSE state switching.
+ * The registers stay with whoever used them last. A switch only sets
+ * CR0.TS; the first FPU instruction of another process then traps with
+ * #NM and the state is swapped there.
+ */
+#pragma once
+
+#include "../types.h"
+#include "../smp.h"
+
+#define FPU_STATE_SIZE 512  /* FXSAVE area */
+
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR0_TS 0x8
+#define CR4_OSFXSR 0x200
+#define CR4_OSXMMEXCPT 0x400
+
+/* Process whose state is loaded in the calling CPU's FPU, 0 for none */
+#define fpu_owner (smp_this_cpu()->fpu_pid)
+
+/* Turns on the FPU and SSE and arms the first trap */
+void fpu_init(void);
+
+/* Called whenever pid becomes the running process */
+void fpu_switch(uint8_t pid);
+
+/* Forgets the state of a process that is going away */
+void fpu_release(uint8_t pid);
+
+/* Saves the state of a terminal's process out of the calling CPU's FPU,
+ * before the terminal moves to another CPU */
+void fpu_save_terminal(int32_t terminal);
+
+/* #NM handler, loads the state of the running process */
+void fpu_handle_trap(void);
+
+/* Lets the kernel use SSE registers. Saves the owner's state, so the next
+ * FPU instruction of any process traps and reloads its own. Interrupts
+ * stay off in between; returns the flags for kernel_fpu_end. */
+uint32_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint32_t flags);
@@ -1,11 +1,22 @@
 #include "handler.h"
 #include "process.h"
+#include "signal.h"
+#include "sched.h"
+#include "fpu.h"
+#include "workqueue.h"
+#include "irq.h"
 #include "../driver/keyboard.h"
 #include "../driver/rtc.h"
+#include "../driver/serial.h"
 #include "../driver/terminal.h"
+#include "../driver/pit.h"
 #include "../interrupt/process.h"
-#include "../i8259.h"
+#include "../apic.h"
 #include "../lib.h"
+#include "../uaccess.h"
+#include "../trace.h"
+#include "../x86_desc.h"
+#include "../smp.h"
 #include "vectors.h"
 
 static const char *exception_messages[LAST_EXC + 1] = {
@@ -29,64 +40,279 @@ static const char *exception_messages[LAST_EXC + 1] = {
     "Alignment Fault",
     "Machine Abort"};
 
+/* What a fault in user code is reported as. Arithmetic faults go with
+ * divide by zero and an invalid opcode gets its own signal, the rest are
+ * bad memory accesses. NMI, double fault, the assertion and machine abort
+ * aren't anything the process can handle, so they always halt it. */
+#define SIG_NONE 0xFF
+static const uint8_t exception_signals[LAST_EXC + 1] = {
+    SIG_DIV_ZERO,  // Division Error
+    SIG_SEGFAULT,  // Reserved 1
+    SIG_NONE,      // Non-maskable Interrupt
+    SIG_SEGFAULT,  // Breakpoint
+    SIG_DIV_ZERO,  // Overflow
+    SIG_SEGFAULT,  // BOUND Range Exceeded
+    SIG_ILLEGAL,   // Invalid Opcode
+    SIG_NONE,      // Device Not Available, fpu.c takes it
+    SIG_NONE,      // Double Fault
+    SIG_SEGFAULT,  // Reserved 9
+    SIG_SEGFAULT,  // Invalid TSS
+    SIG_SEGFAULT,  // Segment Not Present
+    SIG_SEGFAULT,  // Stack Segment Fault
+    SIG_SEGFAULT,  // General Protection Fault
+    SIG_SEGFAULT,  // Page Fault
+    SIG_NONE,      // Assertion Failure
+    SIG_DIV_ZERO,  // Math Fault
+    SIG_SEGFAULT,  // Alignment Fault
+    SIG_NONE};     // Machine Abort
+
+#define KB_FIFO_SIZE 16  // Power of two
+#define KB_FIFO_MASK (KB_FIFO_SIZE - 1)
+
+static void timer_bottom_half(void *arg);
+static void keyboard_bottom_half(void *arg);
+static void rtc_bottom_half(void *arg);
+
+static work_t timer_work = WORK_INIT("timer", timer_bottom_half, NULL);
+static work_t keyboard_work = WORK_INIT("keyboard", keyboard_bottom_half, NULL);
+static work_t rtc_work = WORK_INIT("rtc", rtc_bottom_half, NULL);
+
+/* For proc/softirqs */
+static work_t *bottom_halves[] = {&timer_work, &keyboard_work, &rtc_work};
+
+/* Scancodes read by the top half, translated by the bottom half */
+static uint8_t kb_fifo[KB_FIFO_SIZE];
+static volatile uint32_t kb_fifo_head, kb_fifo_tail;
+
+/* Switch asked for by a bottom half, carried out by irq_exit on the CPU of
+ * that terminal. The ticks ask through cpu_t.need_resched. */
+static int32_t switch_request = -1;
+
 // BEGIN CP1.4 Initialize Devices
 
 /**
  * Timer handler
- * INPUT: None.
- * OUTPUT: None.
- * EFFECT: Handles timer chip interrupt.
+ * INPUT: context: Interrupted frame, dev: unused.
+ * OUTPUT: IRQ_HANDLED.
+ * EFFECT: Top half: tick accounting. Signals and the scheduling decision
+ *         are left to the bottom half.
  */
-void handle_timer() {
-  cli();
-  send_eoi(0);
-  if (sched_enable) {
-    int target_terminal;
-    target_terminal = (active_terminal+1)%NUM_TERMINALS;
-    switch_active_terminal(target_terminal);
+int32_t handle_timer(hw_context_t *context, void *dev) {
+  pcb_t *pcb;
+  // Ticks taken in the idle context only count, idle_loop does the rest
+  if (!sched_tick()) {
+    // Charge the tick to whoever it interrupted, unless it was asleep
+    pcb = processes[terminals[active_terminal].pid];
+    if (pcb && !pcb->waiting) {
+      if (context->cs == USER_CS) pcb->user_ticks++;
+      else pcb->kernel_ticks++;
+    }
   }
-  sti();
+  work_queue(&timer_work);
+  return IRQ_HANDLED;
+}
+
+static void timer_bottom_half(void *arg) {
+  signal_tick();
+  // The PIT ticks for the BSP, the APs have handle_smp_tick
+  if (sched_enable && !cpus[0].in_idle) cpus[0].need_resched = 1;
 }
 
 /**
  * Keyboard handler
+ * INPUT: context: Interrupted frame, dev: unused.
+ * OUTPUT: IRQ_HANDLED.
+ * EFFECT: Top half: only reads the scancode. Echoing, line editing and
+ *         ALT+Fn terminal switches happen in the bottom half.
+ */
+int32_t handle_keyboard(hw_context_t *context, void *dev) {
+  uint8_t scancode = inb(KB_PORT);
+  // A full FIFO drops the key, like a full input buffer does
+  if (kb_fifo_head - kb_fifo_tail < KB_FIFO_SIZE)
+    kb_fifo[kb_fifo_head++ & KB_FIFO_MASK] = scancode;
+  work_queue(&keyboard_work);
+  return IRQ_HANDLED;
+}
+
+static void keyboard_bottom_half(void *arg) {
+  uint8_t c;
+  while (kb_fifo_tail != kb_fifo_head) {
+    c = keyboard_translate(kb_fifo[kb_fifo_tail & KB_FIFO_MASK]);
+    kb_fifo_tail++;
+    terminal_handle_key(c, ctrl_down, alt_down);
+  }
+}
+
+/**
+ * RTC handler
+ * INPUT: context: Interrupted frame, dev: unused.
+ * OUTPUT: IRQ_HANDLED.
+ * EFFECT: Top half: acks the RTC. Waking up readers is the bottom half.
+ */
+int32_t handle_rtc(hw_context_t *context, void *dev) {
+  rtc_ack_irq();         // allow another irq to be genereated
+  test_rtc_ticks_incr(); // increments rtc test tick counter if enabled
+  work_queue(&rtc_work);
+  return IRQ_HANDLED;
+}
+
+static void rtc_bottom_half(void *arg) {
+  rtc_interrupt_recieved();
+}
+
+/**
+ * Serial handler
+ * INPUT: context: Interrupted frame, dev: unused.
+ * OUTPUT: IRQ_HANDLED if the UART had something pending, else IRQ_NONE.
+ * EFFECT: Refills the UART transmit FIFO, drains received bytes.
+ */
+int32_t handle_serial(hw_context_t *context, void *dev) {
+  return serial_interrupt() ? IRQ_HANDLED : IRQ_NONE;
+}
+
+/**
+ * Run queue kick
  * INPUT: None.
  * OUTPUT: None.
- * EFFECT: Handles keyboard interrupt.
+ * EFFECT: Only wakes the CPU from hlt, its idle loop runs the queue.
  */
-void handle_keyboard() {
-  cli();
-  send_eoi(KB_IRQNUM);
-  char c = get_keyboard_input();
-  terminal_handle_key(c, ctrl_down, alt_down);
-  sti();
+void handle_smp_kick() {
+  lapic_eoi();
 }
 
 /**
- * RTC handler
+ * Scheduler tick of an AP, from its LAPIC timer
+ * INPUT: context: Interrupted frame.
+ * OUTPUT: None.
+ * EFFECT: What handle_timer and its bottom half do for the BSP. Nothing
+ *         until the AP runs processes, and no switch before its first
+ *         shell is running.
+ */
+void handle_smp_tick(hw_context_t *context) {
+  cpu_t *cpu = smp_this_cpu();
+  pcb_t *pcb;
+  lapic_eoi();
+  if (!cpu->scheduling || cpu->in_idle) return;
+  pcb = processes[terminals[active_terminal].pid];
+  if (pcb && !pcb->waiting) {
+    if (context->cs == USER_CS) pcb->user_ticks++;
+    else pcb->kernel_ticks++;
+  }
+  if (sched_enable && terminals[active_terminal].pid) cpu->need_resched = 1;
+}
+
+// END CP1.4
+
+/**
+ * Asks for a terminal switch from a bottom half.
+ * INPUT: terminal: Terminal to make active.
+ * OUTPUT: None.
+ * EFFECT: Done by irq_exit once the bottom halves are through.
+ */
+void irq_request_switch(uint8_t terminal) {
+  switch_request = terminal;
+}
+
+/**
+ * Common exit of the hardware interrupt stubs in isr.S.
  * INPUT: None.
  * OUTPUT: None.
- * EFFECT: Handles RTC interrupt.
+ * EFFECT: Runs the queued bottom halves, then switches terminals if one
+ *         of them asked for it. An interrupt taken during a bottom half
+ *         skips both, the irq_exit further down the stack finishes up.
+ *         Switching waits until the bottom halves are done: a stack
+ *         switch inside one would hold up all the others until that
+ *         process runs again. Device interrupts only reach the BSP, so
+ *         only the BSP runs bottom halves.
  */
-void handle_rtc() {
+void irq_exit() {
+  cpu_t *cpu = smp_this_cpu();
+  int32_t target;
+  uint8_t pid;
   cli();
-  outb(0x0C, RTC_PORT);  // select registers C
-  inb(RTC_CMOS_PORT);    // discard value, allow another irq to be genereate
-  test_rtc_ticks_incr(); // increments rtc test tick counter if enabled
-  rtc_interrupt_recieved();
-  send_eoi(RTC_IRQNUM);
-  sti();
+  if (!cpu->index) {
+    if (work_in_progress()) return;
+    work_run_pending();
+  }
+  // The idle context isn't a process, idle_loop switches away itself,
+  // and an AP without a shell yet has nothing to switch
+  if (sched_in_idle || !cpu->scheduling) return;
+  if (cpu->need_resched) {
+    cpu->need_resched = 0;
+    // More to run than this CPU can: give a spare terminal to an idle one
+    sched_balance();
+    target = sched_pick_next();
+    if (target == -1) {
+      // Everybody waits: halt in the idle context until a wakeup
+      sched_idle();
+      target = sched_pick_next();
+    }
+    switch_request = -1;
+    // Within a terminal, take turns between its foreground process and jobs
+    pid = sched_pick_process(target);
+    if (target == active_terminal) {
+      if (pid) switch_terminal_process(pid);
+    } else {
+      if (pid) terminals[target].pid = pid;
+      switch_active_terminal(target);
+    }
+  } else if (switch_request != -1 &&
+             smp_terminal_cpu(switch_request) == cpu->index) {
+    target = switch_request;
+    switch_request = -1;
+    switch_active_terminal(target);
+  }
 }
 
-// END CP1.4
+/* proc/softirqs: runs and longest run (TSC cycles, interrupts on) of
+ * each bottom half */
+void softirq_info(procfs_out_t *out) {
+  uint32_t i;
+  procfs_puts(out, "     RUNS       MAX  NAME\n");
+  for (i = 0; i < sizeof(bottom_halves) / sizeof(bottom_halves[0]); i++) {
+    procfs_putu(out, bottom_halves[i]->runs, 9);
+    procfs_putu(out, bottom_halves[i]->max_cycles, 10);
+    procfs_puts(out, "  ");
+    procfs_puts(out, bottom_halves[i]->name);
+    procfs_puts(out, "\n");
+  }
+}
 
 /**
  * Exception handler for a given vector number.
- * INPUT: None.
+ * INPUT: context: Frame built by the isr.S stub, holds the vector number.
  * OUTPUT: None.
- * EFFECT: Handles syscall.
+ * EFFECT: Page faults in user copies resume at their fixup (uaccess.h).
+ *         Faults in user code become signals (see exception_signals) if
+ *         the process handles them, everything else halts the process.
  */
-void handle_exception(uint8_t vector_no) {
+void handle_exception(hw_context_t *context) {
+  uint8_t vector_no = context->vector;
+  uint8_t pid = terminals[active_terminal].pid;
+  uint8_t signum = (vector_no <= LAST_EXC) ? exception_signals[vector_no] : SIG_NONE;
+  uint32_t fixup, address;
+  // Not an error: first FPU instruction since a switch, see fpu.c
+  if (vector_no == EXC_DEVICE_NOT_AVAIL) {
+    fpu_handle_trap();
+    return;
+  }
+  if (vector_no == EXC_PAGE_FAULT && (TRACE_MASK & TRACE_FAULT)) {
+    asm volatile("movl %%cr2, %0" : "=r"(address));
+    trace_event(TRACE_FAULT, TRACE_EV_PAGE_FAULT, address, context->eip);
+  }
+  // A user copy hit a bad pointer: the copy fails, not the process
+  if (vector_no == EXC_PAGE_FAULT && context->cs == KERNEL_CS) {
+    fixup = search_ex_table(context->eip);
+    if (fixup) {
+      context->eip = fixup;
+      return;
+    }
+  }
+  if (context->cs == USER_CS && signal_catchable(pid, signum)) {
+    // Delivered by interrupt_return on the way out
+    signal_raise(pid, signum);
+    return;
+  }
   // TODO: Display a BSOD for the given interrupt vector
   printf("EXCEPTION\n");
   printf("Vector #%d: %s\n", vector_no, exception_messages[vector_no]);
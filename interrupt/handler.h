@@ -6,25 +6,57 @@
 #pragma once
 
 #include "../types.h"
+#include "../driver/procfs.h"
 
-extern void handle_timer();
-extern void handle_keyboard();
-extern void handle_rtc();
-extern void handle_exception(uint8_t vector_no);
+/* Register frame built by every stub in isr.S and by handle_syscall.
+ * Lowest address first, i.e. the order things come off the stack.
+ */
+typedef struct {
+  uint32_t edi;
+  uint32_t esi;
+  uint32_t ebp;
+  uint32_t esp_kernel;  // Value pushed by pushal, ignored by popal
+  uint32_t ebx;
+  uint32_t edx;
+  uint32_t ecx;
+  uint32_t eax;
+  uint32_t vector;
+  uint32_t error_code;
+  /* Pushed by the CPU */
+  uint32_t eip;
+  uint32_t cs;
+  uint32_t eflags;
+  /* Only valid when coming from user mode (cs == USER_CS) */
+  uint32_t esp;
+  uint32_t ss;
+} hw_context_t;
+
+/* Top halves, registered with request_irq (see irq.h) */
+extern int32_t handle_timer(hw_context_t *context, void *dev);
+extern int32_t handle_keyboard(hw_context_t *context, void *dev);
+extern int32_t handle_rtc(hw_context_t *context, void *dev);
+extern int32_t handle_serial(hw_context_t *context, void *dev);
+extern void handle_smp_kick();
+extern void handle_smp_tick(hw_context_t *context);
+extern void handle_exception(hw_context_t *context);
+
+/* Called by every IRQ stub after its handler (the top half): runs the
+ * bottom halves with interrupts on and then any requested switch */
+extern void irq_exit();
+/* Terminal switch from a bottom half, done on the way out by irq_exit */
+extern void irq_request_switch(uint8_t terminal);
+extern void softirq_info(procfs_out_t *out);
 
-extern void keyboard_isr();
-extern void rtc_isr();
-extern void timer_isr();
+extern void spurious_isr();
+extern void smp_kick_isr();
+extern void smp_tick_isr();
 
 extern void default_interrupt();
 
-// Now, since handle_exception requires a parameter, but exceptor handler cannot
-// take a parameter, we allow the table generation code to declare its own
-// "partials". Each of which will spawn its own function.
+// Every exception gets its own entry stub in isr.S, which pushes the vector
+// number and hands the frame to handle_exception. The stubs are named after
+// the vector macro, e.g. handle_exc_EXC_DIVIDE.
 #define HANDLE_EXC_FUNCTION_NAME(VEC_NO) handle_exc_##VEC_NO
-#define DEF_HANDLE_EXC_PARTIAL(VEC_NO)                                         \
-  void handle_exc_##VEC_NO() { handle_exception(VEC_NO); }
+#define DECL_HANDLE_EXC_STUB(VEC_NO) extern void handle_exc_##VEC_NO();
 
-// Since these partials must be used in-situ, we declare them
-// at table.c. Can't do it here or in handler.c because the macros
-// only contain definitions.
+// Declared at table.c next to where they are used.
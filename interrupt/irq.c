@@ -0,0 +1,121 @@
+/**
+ * IRQ dispatch.
+ * Actions come from a fixed pool and are chained per line in the order
+ * they were requested. Chains are only modified with interrupts off and
+ * devices only interrupt the BSP, so do_irq walks them without a lock.
+ */
+#include "irq.h"
+#include "vectors.h"
+#include "../lib.h"
+#include "../tsc.h"
+#include "../irqoff.h"
+#include "../trace.h"
+
+irq_stat_t irq_stats[IRQ_NUM_LINES];
+
+static irq_action_t actions[IRQ_MAX_ACTIONS];
+static irq_action_t *lines[IRQ_NUM_LINES];
+
+/**
+ * Registers a handler on a line.
+ * INPUT: irq: ISA line, handler: top half, name: shown in proc/irqs,
+ *        dev: cookie for the handler and free_irq, flags: IRQF_*
+ * OUTPUT: 0 on success, -1 on failure
+ */
+int32_t request_irq(uint32_t irq, irq_handler_t handler, const int8_t *name,
+                    void *dev, uint32_t flags) {
+    irq_action_t *action = NULL, **tail;
+    uint32_t i, saved;
+    if (irq >= IRQ_NUM_LINES || !handler) return -1;
+    irqoff_save(saved);
+    if (lines[irq] && !(lines[irq]->flags & flags & IRQF_SHARED)) {
+        irqoff_restore(saved);
+        return -1;
+    }
+    for (i = 0; i < IRQ_MAX_ACTIONS && !action; i++)
+        if (!actions[i].handler) action = &actions[i];
+    if (!action) {
+        irqoff_restore(saved);
+        return -1;
+    }
+    action->handler = handler;
+    action->dev = dev;
+    action->name = name;
+    action->flags = flags;
+    action->next = NULL;
+    for (tail = &lines[irq]; *tail; tail = &(*tail)->next);
+    *tail = action;
+    if (lines[irq] == action) irq_enable(irq);
+    irqoff_restore(saved);
+    return 0;
+}
+
+/**
+ * Unregisters a handler.
+ * INPUT: irq: ISA line, dev: cookie it was requested with
+ * OUTPUT: 0 on success, -1 if not found
+ */
+int32_t free_irq(uint32_t irq, void *dev) {
+    irq_action_t **link, *action;
+    uint32_t saved;
+    if (irq >= IRQ_NUM_LINES) return -1;
+    irqoff_save(saved);
+    for (link = &lines[irq]; *link; link = &(*link)->next) {
+        if ((*link)->dev != dev) continue;
+        action = *link;
+        *link = action->next;
+        action->handler = NULL;
+        if (!lines[irq]) irq_disable(irq);
+        irqoff_restore(saved);
+        return 0;
+    }
+    irqoff_restore(saved);
+    return -1;
+}
+
+/**
+ * Dispatches a hardware interrupt.
+ * INPUT: context: Frame built by the stub, vector included
+ * OUTPUT: None
+ * EFFECT: Every handler on a shared line is called, since more than one
+ *         device may be asking. The time spent is charged to the line.
+ */
+void do_irq(hw_context_t *context) {
+    uint32_t irq = (context->vector - VEC_IRQ_BASE) % IRQ_NUM_LINES;
+    irq_stat_t *stat = &irq_stats[irq];
+    irq_action_t *action;
+    int32_t handled = IRQ_NONE;
+    uint64_t start = rdtsc();
+    uint32_t cycles;
+    for (action = lines[irq]; action; action = action->next)
+        handled |= action->handler(context, action->dev);
+    irq_eoi(irq);
+    cycles = (uint32_t)(rdtsc() - start);
+    stat->count++;
+    if (handled == IRQ_NONE) stat->spurious++;
+    stat->cycles += cycles;
+    if (cycles > stat->max_cycles) stat->max_cycles = cycles;
+    trace_event(TRACE_IRQ, TRACE_EV_IRQ, context->vector, cycles);
+}
+
+/* proc/irqs: lines that have a handler or have fired, with the cycles
+ * their handlers took (kcycles total, max in cycles) */
+void irq_info(procfs_out_t *out) {
+    irq_action_t *action;
+    uint32_t irq;
+    procfs_puts(out, "IRQ     COUNT  SPURIOUS   KCYCLES       MAX  HANDLERS\n");
+    for (irq = 0; irq < IRQ_NUM_LINES; irq++) {
+        if (!lines[irq] && !irq_stats[irq].count) continue;
+        procfs_putu(out, irq, 3);
+        procfs_putu(out, irq_stats[irq].count, 10);
+        procfs_putu(out, irq_stats[irq].spurious, 10);
+        procfs_putu(out, (uint32_t)(irq_stats[irq].cycles >> 10), 10);
+        procfs_putu(out, irq_stats[irq].max_cycles, 10);
+        procfs_puts(out, " ");
+        for (action = lines[irq]; action; action = action->next) {
+            procfs_puts(out, " ");
+            procfs_puts(out, action->name);
+        }
+        procfs_puts(out, "\n");
+    }
+}
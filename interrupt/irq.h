@@ -0,0 +1,61 @@
+/**
+ * Hardware interrupt lines: handler registration and dispatch.
+ * Every ISA line gets the same entry stub in isr.S, which hands the frame
+ * to do_irq. Drivers attach to a line with request_irq; lines flagged
+ * shared can carry several handlers, each asked in turn.
+ */
+#pragma once
+
+#include "../types.h"
+#include "../apic.h"
+#include "../driver/procfs.h"
+#include "handler.h"
+
+#define IRQ_NUM_LINES APIC_NUM_ISA_IRQS
+#define IRQ_MAX_ACTIONS 32
+
+/* Handler results: whether its device raised the interrupt */
+#define IRQ_NONE 0
+#define IRQ_HANDLED 1
+
+/* request_irq flags */
+#define IRQF_SHARED 0x1  /* Every handler on the line has to pass it */
+
+/* Top half: runs with interrupts off and the EOI still pending */
+typedef int32_t (*irq_handler_t)(hw_context_t *context, void *dev);
+
+typedef struct irq_action {
+    irq_handler_t handler;
+    void *dev;  /* Passed back to the handler, identifies it to free_irq */
+    const int8_t *name;
+    uint32_t flags;
+    struct irq_action *next;
+} irq_action_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t spurious;  /* No handler claimed it */
+    uint64_t cycles;  /* Spent in the handlers */
+    uint32_t max_cycles;
+} irq_stat_t;
+
+extern irq_stat_t irq_stats[IRQ_NUM_LINES];
+
+/* Entry stubs, one per line, for init_idt */
+extern void *irq_stubs[IRQ_NUM_LINES];
+
+/* Attaches a handler to a line and unmasks it if it was free.
+ * Returns 0, or -1 for a bad line, a line already taken without
+ * IRQF_SHARED on both sides, or no actions left. */
+int32_t request_irq(uint32_t irq, irq_handler_t handler, const int8_t *name,
+                    void *dev, uint32_t flags);
+
+/* Detaches the handler registered with dev, masking the line once it is
+ * free. Returns 0, or -1 if there was no such handler. */
+int32_t free_irq(uint32_t irq, void *dev);
+
+/* Called by the stubs: runs every handler on the line, then sends the EOI */
+void do_irq(hw_context_t *context);
+
+/* proc/irqs */
+void irq_info(procfs_out_t *out);
@@ -3,48 +3,220 @@
 #include "../filesystem.h"
 #include "../lib.h"
 #include "../paging.h"
+#include "../shm.h"
+#include "../buddy.h"
+#include "../fsext.h"
+#include "../tlb.h"
+#include "../boottime.h"
+#include "../apic.h"
+#include "../smp.h"
+#include "../spinlock.h"
+#include "../fastmem.h"
+#include "../uaccess.h"
+#include "../trace.h"
+#include "../execcache.h"
+#include "../irqoff.h"
+#include "sched.h"
 #include "../x86_desc.h"
 #include "../driver/terminal.h"
 
 /* 0 defaults to only switching tasks on terminal chnages, 1 enables schedular code from PIT ints*/
 int sched_enable = 1;
 
-pcb_t* processes[NUM_PROCESSES];
+#define USER_PAGE_FLAGS 0x87  /* Present, R/W, User, 4MB */
+#define USER_EFLAGS 0x202  /* IF on */
+#define BACKGROUND_MARK '&'
+
+static void process_switch(uint8_t from, uint8_t to);
+
+extern uint32_t pgDir[];
+
+#define PCB_PAGE_FLAGS 0x3  /* Present, R/W, supervisor */
+#define PCB_FRAME_ORDER 1  /* Two frames: PROCESS_KERNEL_STACK_SIZE */
+
+pcb_t* processes[PID_LIMIT];
+volatile uint32_t num_pids = MIN_PID;
 uint8_t process_exit_code;
 
+/* Page table of the PCB window, shared by every CPU. Entries only ever go
+ * from not present to present, which needs no TLB flush anywhere. */
+static uint32_t pgTblPcb[1024] __attribute__((aligned(4096)));
+
+/* Guards PID allocation */
+static spinlock_t process_lock = SPINLOCK_INIT;
+
+/* Spare kernel stack per CPU a shell is started on when switching to a
+ * terminal nobody used yet, see switch_to_process */
+static uint8_t launch_stack[SMP_MAX_CPUS][PROCESS_KERNEL_STACK_SIZE] __attribute__((aligned(16)));
+static uint32_t launch_esp[SMP_MAX_CPUS];
+
+/* Maps the user frame of a process at 128MB. It's a single 4MB entry, so
+ * one invlpg is enough and the rest of the TLB survives. Each CPU has its
+ * own page directory, this is the calling CPU's. */
+void map_user_page(uint8_t pid) {
+    smp_this_cpu()->pgdir[USER_PDE_INDEX] = processes[pid]->user_frame | USER_PAGE_FLAGS;
+    invlpg(PROCESS_START_LOCATION);
+}
+
+/* Clears the counters shown by proc/top */
+static void reset_accounting(uint8_t pid) {
+    processes[pid]->user_ticks = 0;
+    processes[pid]->kernel_ticks = 0;
+    processes[pid]->syscall_count = 0;
+    processes[pid]->switch_count = 0;
+}
+
+/* Backs the PCB and kernel stack of a new PID with frames mapped into the
+ * PCB window, and puts the PCB in its initial state. Returns 0, -1 when
+ * out of memory. */
+static int32_t pcb_create(uint8_t pid) {
+    uint32_t frames = frame_alloc(PCB_FRAME_ORDER);
+    uint32_t page = (PCB_ADDR(pid) >> 12) & 0x3FF;
+    uint8_t fd;
+    if (!frames) return -1;
+    pgTblPcb[page] = frames | PCB_PAGE_FLAGS | PAGE_GLOBAL;
+    pgTblPcb[page + 1] = (frames + FRAME_SIZE) | PCB_PAGE_FLAGS | PAGE_GLOBAL;
+    processes[pid] = (pcb_t*)PCB_ADDR(pid);
+    processes[pid]->in_use = 0;
+    processes[pid]->pid = pid;
+    processes[pid]->parent_pid = NULL;
+    processes[pid]->terminal = 0;
+    processes[pid]->exec_child = 0;
+    processes[pid]->background = 0;
+    processes[pid]->zombie = 0;
+    processes[pid]->args[0]=0; // Clear the string
+    processes[pid]->user_frame = 0;
+    processes[pid]->shm_attached = 0;
+    processes[pid]->waiting = 0;
+    processes[pid]->fpu_used = 0;
+    processes[pid]->name[0] = 0;
+    reset_accounting(pid);
+    signal_init_process(pid);
+    for (fd = 0; fd < NUM_FILE_DESCRIPTORS; fd++) {
+        processes[pid]->file_descriptors[fd].flags = 0;
+    }
+    return 0;
+}
+
+/**
+ * Claims a free PID by marking it in use.
+ * INPUT: None
+ * OUTPUT: The PID, 0 if every PID is taken or no memory is left for a
+ *         new PCB
+ * EFFECT: PCBs are kept once created, a PID that comes free is reused
+ *         before a new one gets made.
+ */
+uint8_t alloc_pid() {
+    uint8_t pid;
+    uint32_t flags;
+    spin_lock_irqsave(&process_lock, flags);
+    for (pid = MIN_PID; pid < num_pids; pid++) {
+        if (!processes[pid]->in_use) break;
+    }
+    if (pid == num_pids) {
+        if (num_pids < PID_LIMIT && !pcb_create(pid)) num_pids++;
+        else pid = 0;
+    }
+    if (pid) processes[pid]->in_use = 1;
+    spin_unlock_irqrestore(&process_lock, flags);
+    return pid;
+}
+
 /**
  * Initializes the PCB memory locations.
  * INPUT: None
  * OUTPUT: None
  * EFFECT:
- *   - Compute the PCB offset addresses for each PCB.
- *   - Store each into processes table.
- *   - Initialize each PCB to its initial state.
+ *   - Map the empty PCB window, PCBs get created by alloc_pid.
+ *   - Bring up what the processes need, the other CPUs included. They
+ *     copy the page directory, so the window goes in first.
  */
 void init_pcb () {
-    uint8_t fd, pid;
     // STEP 1: Initialize ghostd process (0) to NULL
     processes[0] = NULL;
-    // STEP 2: Iterate thru pids 1 to 8
-    for (pid = 1; pid < NUM_PROCESSES; pid++) {
-        /* Base address of PCB: 8MB - 8kb*pid */
-        processes[pid] = (pcb_t*) (KERNEL_AREA_BOTTOM - (pid * PROCESS_KERNEL_STACK_SIZE));
-        processes[pid]->in_use = 0;
-        processes[pid]->pid = pid;
-        processes[pid]->parent_pid = NULL;
-        processes[pid]->args[0]=0; // Clear the string
-        for (fd = 0; fd < NUM_FILE_DESCRIPTORS; fd++) {
-            processes[pid]->file_descriptors[fd].flags = 0;
+    pgDir[PCB_PDE_INDEX] = (uint32_t)pgTblPcb | PCB_PAGE_FLAGS;
+    // Kernel mappings survive process switches from now on
+    tlb_init();
+    fsext_init();
+    fpu_init();
+    apic_init();
+    smp_init();
+    boot_phase("pcb");
+}
+
+/* Drops a trailing '&' (and the spaces around it) from a command line.
+ * Returns 1 if there was one. */
+static uint8_t strip_background(char* line) {
+    int32_t end = strlen(line);
+    while (end > 0 && line[end - 1] == ' ') end--;
+    if (end == 0 || line[end - 1] != BACKGROUND_MARK) return 0;
+    end--;
+    while (end > 0 && line[end - 1] == ' ') end--;
+    line[end] = 0;
+    return 1;
+}
+
+/* Lays out the fresh kernel stack of a background process: an iret frame
+ * into its entry point, under it what context_switch pops on the way to
+ * process_first_run. Returns the esp to park in context_esp. */
+static uint32_t first_run_frame(uint8_t pid, void* entry_eip) {
+    uint32_t* frame = (uint32_t*)processes[pid]->esp0;
+    *--frame = USER_DS;
+    *--frame = PROCESS_ESP_LOCATION;
+    *--frame = USER_EFLAGS;
+    *--frame = USER_CS;
+    *--frame = (uint32_t)entry_eip;
+    *--frame = (uint32_t)process_first_run;
+    *--frame = 0;  // ebp
+    *--frame = 0;  // ebx
+    *--frame = 0;  // esi
+    *--frame = 0;  // edi
+    return (uint32_t)frame;
+}
+
+/* Children of a process that is going away: zombies are reaped on the
+ * spot, the live ones reap themselves when they halt */
+static void orphan_children(uint8_t pid) {
+    uint8_t child;
+    for (child = MIN_PID; child < num_pids; child++) {
+        if (!processes[child]->in_use || processes[child]->parent_pid != pid)
+            continue;
+        processes[child]->parent_pid = 0;
+        if (processes[child]->zombie) {
+            processes[child]->zombie = 0;
+            processes[child]->in_use = 0;
         }
     }
 }
 
+/* Collects the halted background children of a process. The shell never
+ * calls waitpid, so every finished '&' job would otherwise keep its PID
+ * for good; execute() runs this for the caller before taking a new one.
+ * A parent that wants an exit status has to wait before starting more. */
+static void reap_zombies(uint8_t parent) {
+    uint8_t child;
+    uint32_t flags;
+    irqoff_save(flags);
+    for (child = MIN_PID; child < num_pids; child++) {
+        if (!processes[child]->in_use || !processes[child]->zombie ||
+            processes[child]->parent_pid != parent)
+            continue;
+        processes[child]->zombie = 0;
+        processes[child]->in_use = 0;
+        processes[child]->parent_pid = NULL;
+    }
+    irqoff_restore(flags);
+}
+
 /**
- * Executes the given file. This should be called by the syscall wrapper.
- * INPUT: command (string): The command
+ * Executes the given file. Processes get here through sys_execute.
+ * INPUT: command (string): The command, in kernel memory. A trailing '&'
+ *        runs it in the background, next to the caller.
  * OUTPUT: None
- * RETURN: Status code from the process
+ * RETURN: Status code from the process, or right away the PID of a
+ *         background one
  * EFFECT:
+ * - Reap the caller's finished background jobs
  * - Parse args
  * - Check file validity
  * - Set up paging
@@ -57,71 +229,111 @@ void init_pcb () {
  */
 int32_t execute(const str command) {
     int32_t result;  // Stores last command's result
-    uint8_t tmpbuffer[PROCESS_HEADER_BLOCK_LENGTH];  // Used for checking magic and loading EIP
+    exec_image_t image;  // Entry point and block list of the executable
     uint8_t pid = 0;  // PID to be used for the process
     void* entry_eip;
     char args[SIZE_INPUT_BUFFER];
     char filename[SIZE_INPUT_BUFFER];
+    char line[SIZE_INPUT_BUFFER];
+    uint8_t parent = terminals[active_terminal].pid;
+    uint8_t background;
+    uint32_t flags;
 
     // TODO: integrate get args
-    /* STEP 1: Parse the args */
-    result = get_args_from_cmd(command, filename, args);
+    /* STEP 1: Parse the args. Only a process can have background children. */
+    strncpy(line, command, SIZE_INPUT_BUFFER - 1);
+    line[SIZE_INPUT_BUFFER - 1] = 0;
+    background = strip_background(line) && parent;
+    result = get_args_from_cmd(line, filename, args);
     // printf("BRIEFING===\nEXE=%s\nPARAM=%s\n", filename, args);
     if (result == -1) {
         printf("Failed to parse command: %d. (step1)\n", result);
         goto bail;
     }
-    dentry_t exec_dentry;
     // strncpy((char*)filename, "shell", 6);
-    /* STEP 2: Check file validity */
-    result = read_dentry_by_name(filename, &exec_dentry);
-    if (result == -1) {
-        printf("Executable file does not exist: %d. (step2)\n", result);
-        goto bail;
-    }
-    // Check the magic string
-    result = file_read(exec_dentry.inode_num, tmpbuffer, sizeof(tmpbuffer), 0);
+    /* STEP 2: Check file validity. The magic is only checked the first
+     * time, after that the cache remembers what the header said. */
+    result = exec_cache_lookup(filename, &image);
     if (result == -1) {
-        printf("Error reading magic number from file: %d. (step2)\n", result);
-        goto bail;
-    }
-    if (*((uint32_t*) tmpbuffer) != EXECUTABLE_MAGIC) {
-        printf("File is not an executable, magic = %x\n", tmpbuffer);
+        printf("No executable named %s. (step2)\n", filename);
         goto bail;
     }
 
-    /* STEP 3: Find a PID and confirm the entrypoint */
-    entry_eip = (void*) *((uint32_t*) (tmpbuffer + PROCESS_EIP_LOCATION));
-    pid = 1;
-    for (pid = 1; pid < NUM_PROCESSES; pid++) {
-        if (!processes[pid]->in_use) break;
-    }
-    if (pid >= NUM_PROCESSES) {
+    /* STEP 3: Find a PID and confirm the entrypoint. Finished jobs of the
+     * caller give theirs back first. */
+    entry_eip = (void*) image.entry;
+    if (parent) reap_zombies(parent);
+    pid = alloc_pid();
+    if (!pid) {
         printf("Can't allocate a PID for the process.\n");
         goto bail;
     }
 
-    /* STEP 4: Set up paging */
-    set_page_for_process(pid);
+    /* STEP 4: Set up paging. Interrupts stay off until the page table
+     * matches the running process again, or a switch in between would map
+     * the wrong user page back in under the image load. */
+    processes[pid]->user_frame = frame_alloc(BUDDY_ORDER_4MB);
+    if (!processes[pid]->user_frame) {
+        printf("Out of memory for the process.\n");
+        processes[pid]->in_use = 0;
+        goto bail;
+    }
+    processes[pid]->shm_attached = 0;
+    processes[pid]->fpu_used = 0;
+    irqoff_save(flags);
+    shm_switch(pid);
+    map_user_page(pid);
+    fpu_switch(pid);
 
-    /* STEP 5: Load file into memory */
-    load_program(filename);
+    /* STEP 5: Load file into memory, straight from the cached blocks */
+    if (exec_cache_load(&image, (uint8_t*) PROCESS_LD_LOCATION) != (int32_t)image.length) {
+        printf("Failed to load %s. (step5)\n", filename);
+        goto unload;
+    }
 
     /* STEP 6: Create PCB, Open stdin and stdout */
-    processes[pid]->in_use = 1;
-    processes[pid]->parent_pid = terminals[active_terminal].pid;
-    processes[pid]->esp0 = (tss.esp0 = KERNEL_AREA_BOTTOM - pid*PROCESS_KERNEL_STACK_SIZE - 4);
-    tss.ss0 = KERNEL_DS;
-    strncpy((int8_t*)processes[pid]->args, (int8_t*)args, SIZE_INPUT_BUFFER);
-
-    /* Switch to this PID as the current process */
-    terminals[active_terminal].pid = pid;
+    processes[pid]->waiting = 0;
+    processes[pid]->last_cpu = smp_this_cpu()->index;
+    fast_strncpy((int8_t*)processes[pid]->name, (int8_t*)filename, PROCESS_NAME_LENGTH - 1);
+    processes[pid]->name[PROCESS_NAME_LENGTH - 1] = 0;
+    reset_accounting(pid);
+    signal_init_process(pid);
+    processes[pid]->parent_pid = parent;
+    processes[pid]->terminal = active_terminal;
+    processes[pid]->exec_child = 0;
+    processes[pid]->background = background;
+    processes[pid]->zombie = 0;
+    processes[pid]->esp0 = PCB_ADDR(pid) + PROCESS_KERNEL_STACK_SIZE - 4;
+    smp_this_cpu()->tss->ss0 = KERNEL_DS;
+    fast_strncpy((int8_t*)processes[pid]->args, (int8_t*)args, SIZE_INPUT_BUFFER);
     /* Open STDIN/OUT */
     processes[pid]->file_descriptors[FD_STDIN].flags = 1;
     processes[pid]->file_descriptors[FD_STDIN].operations_table = DRIVER_TERMINAL;
     processes[pid]->file_descriptors[FD_STDOUT].flags = 1;
     processes[pid]->file_descriptors[FD_STDOUT].operations_table = DRIVER_TERMINAL;
     // TODO: Put the operations table index in these two FDs.
+    trace_event(TRACE_PROC, TRACE_EV_EXECUTE, pid, parent);
+
+    if (background) {
+        /* The parent keeps its address space and carries on. The child
+         * starts in process_first_run once the scheduler picks it. */
+        processes[pid]->context_esp0 = processes[pid]->esp0;
+        processes[pid]->context_esp = first_run_frame(pid, entry_eip);
+        shm_switch(parent);
+        map_user_page(parent);
+        fpu_switch(parent);
+        irqoff_restore(flags);
+        return pid;
+    }
+
+    /* Switch to this PID as the current process. The parent is parked in
+     * here until the child halts, the scheduler leaves it alone. */
+    smp_this_cpu()->tss->esp0 = processes[pid]->esp0;
+    terminals[active_terminal].pid = pid;
+    if (!parent || terminals[active_terminal].fg_pid == parent)
+        terminals[active_terminal].fg_pid = pid;
+    if (parent) processes[parent]->exec_child = pid;
+    irqoff_restore(flags);
 
     /* STEP 7: Prepare for context switching */
     // Save the Parent ESP and EBP for returning control
@@ -131,6 +343,10 @@ int32_t execute(const str command) {
         :"=r"(processes[pid]->parent_esp), "=r"(processes[pid]->parent_ebp)
     );
 
+    /* The first shell going to user mode ends the boot */
+    boot_finish();
+    kernel_exit(USER_CS);
+
     /* STEP 8: Push IRET context to stack; IRET */
     // TODO: Step 8: Complete the ASM
     asm volatile (
@@ -161,12 +377,33 @@ int32_t execute(const str command) {
     /* STEP 9: Return point from halt() */
     return process_exit_code;
 
+    // Undo STEP 4, the parent gets its address space back
+    unload:
+    frame_free(processes[pid]->user_frame, BUDDY_ORDER_4MB);
+    processes[pid]->user_frame = 0;
+    processes[pid]->in_use = 0;
+    shm_switch(parent);
+    if (parent) map_user_page(parent);
+    fpu_switch(parent);
+    irqoff_restore(flags);
+
     // Standard exception throwing format, courtesy of Riverbed Inc
     bail:
     printf("Execution failed.\n");
     return -1;
 }
 
+/**
+ * The execute syscall: copies the command in, then runs it.
+ * INPUT: command: User string, a line of at most SIZE_INPUT_BUFFER bytes
+ * OUTPUT: As execute, -1 if command is a bad pointer or too long
+ */
+int32_t sys_execute(const str command) {
+    int8_t line[SIZE_INPUT_BUFFER];
+    if (strncpy_from_user(line, command, sizeof(line)) < 0) return -1;
+    return execute(line);
+}
+
 /**
  * Halts the current process.
  * INPUT: status (byte): Exit code
@@ -177,28 +414,56 @@ int32_t execute(const str command) {
  * - Restore parent paging
  * - Close any relevant FDs
  * - Jump to execute()'s return
+ * A background process has nobody waiting in execute(): it stays a zombie
+ * for waitpid and hands the CPU to another process of its terminal.
  */
 int32_t halt(uint8_t status) {
     int i;
-    process_exit_code = status;
     pcb_t* cur_pcb = processes[terminals[active_terminal].pid];
     uint8_t parent_pid = processes[terminals[active_terminal].pid]->parent_pid;
+    uint8_t next;
+    trace_event(TRACE_PROC, TRACE_EV_HALT, cur_pcb->pid, status);
 
     // STEP 1: Clear the PCB for this process
-    processes[terminals[active_terminal].pid]->in_use = 0;
-    processes[terminals[active_terminal].pid]->parent_pid = NULL;
+    if (cur_pcb->background && parent_pid) {
+        cur_pcb->exit_status = status;
+        cur_pcb->zombie = 1;
+    } else {
+        cur_pcb->in_use = 0;
+        cur_pcb->parent_pid = NULL;
+    }
+    orphan_children(cur_pcb->pid);
 
-    // STEP 2: Close all files
+    // STEP 2: Close all files and shared segments
     for (i = 0; i < NUM_FILE_DESCRIPTORS; i++) {
         if (cur_pcb->file_descriptors[i].flags) close(i);
     }
+    shm_detach_all(cur_pcb->pid);
+    frame_free(cur_pcb->user_frame, BUDDY_ORDER_4MB);
+    cur_pcb->user_frame = 0;
+    fpu_release(cur_pcb->pid);
+    if (cur_pcb->background) {
+        // STEP 3: Wake a parent sitting in waitpid, then leave for good
+        irqoff_cli();
+        if (parent_pid) sched_wakeup(processes[parent_pid]);
+        next = sched_pick_process(active_terminal);
+        if (!next) next = terminals[active_terminal].fg_pid;  // Asleep, but alive
+        terminals[active_terminal].pid = next;
+        process_switch(cur_pcb->pid, next);
+    }
     // STEP 3: Set current pid to parent
+    process_exit_code = status;
     terminals[active_terminal].pid = parent_pid;
+    if (terminals[active_terminal].fg_pid == cur_pcb->pid)
+        terminals[active_terminal].fg_pid = parent_pid;
     if (parent_pid) {
+        processes[parent_pid]->exec_child = 0;
         // STEP 4: Set page to parent
-        set_page_for_process(parent_pid);
+        shm_switch(parent_pid);
+        map_user_page(parent_pid);
+        fpu_switch(parent_pid);
         // STEP 5: Restore TSS, esp, ebp to parent
-        tss.esp0 = processes[parent_pid]->esp0;
+        smp_this_cpu()->tss->esp0 = processes[parent_pid]->esp0;
         asm volatile (
                 "movl %1, %%ebp;"
                 "movl %0, %%esp;"
@@ -214,15 +479,77 @@ int32_t halt(uint8_t status) {
     return 0; // only for warning suppression
 }
 
+/**
+ * Counts a syscall against the current process. Called from handle_syscall.
+ * INPUT: None
+ * OUTPUT: None
+ */
+void process_count_syscall() {
+    uint8_t pid = terminals[active_terminal].pid;
+    if (pid) processes[pid]->syscall_count++;
+}
+
 /* int32_t vidmap(uint8_t **screen_start)
  * Inputs:  ** screen_start double pointer 
- * Return Value: screen_start 
+ * Return Value: 0, -1 if screen_start can't be written
 
- * Function: This function is just used to call vidmap_user_page which does most of the work. 
-   Return vidmap_user_page(screen_start).  */
+ * Function: Maps video memory at 136MB through the calling CPU's own vidmap
+   table (smp_vidmap) and stores that address in *screen_start.  */
 int32_t vidmap(uint8_t **screen_start) {
+    uint8_t* probe = NULL;
+    // A pointer we can't write to fails here rather than mapping anything
+    if (copy_to_user(screen_start, &probe, sizeof(probe))) return -1;
+    // Each CPU maps it in its own table, the process may move between them
+    smp_vidmap();
+    probe = (uint8_t*)(VIDMAP_PDE_INDEX << 22);
+    return copy_to_user(screen_start, &probe, sizeof(probe)) ? -1 : 0;
+}
+
+/* Points the calling CPU at a process about to resume: TSS, paging,
+ * FPU. Its kernel stack is in the PCB window, the same on every CPU. */
+static void process_load(uint8_t pid) {
+    smp_this_cpu()->tss->esp0 = processes[pid]->context_esp0;
+    processes[pid]->last_cpu = smp_this_cpu()->index;
+    shm_switch(pid);
+    map_user_page(pid);
+    smp_vidmap_load();
+    fpu_switch(pid);
+}
 
-    return vidmap_user_page(screen_start); // just used as helper
+/* Saves the running process and resumes another one: TSS, paging, FPU,
+ * then the kernel stack. Called with interrupts off; returns once the
+ * scheduler switches back to from, maybe on another CPU. */
+static void process_switch(uint8_t from, uint8_t to) {
+    pcb_t* prev = processes[from];
+    prev->context_esp0 = smp_this_cpu()->tss->esp0;
+    prev->switch_count++;
+    trace_event(TRACE_SWITCH, TRACE_EV_SWITCH, from, to);
+    process_load(to);
+    kernel_context_switch(&prev->context_esp, processes[to]->context_esp);
+}
+
+/**
+ * Resumes a process on a CPU that wasn't running one: an AP that took
+ * over a terminal from a busier CPU, see sched_balance.
+ * INPUT: pid: Process parked by process_switch
+ *        save_esp: Where the caller's context goes, nothing resumes it
+ * OUTPUT: None, doesn't return
+ * EFFECT: Called with interrupts off and the kernel lock held.
+ */
+void process_resume(uint8_t pid, uint32_t* save_esp) {
+    process_load(pid);
+    kernel_context_switch(save_esp, processes[pid]->context_esp);
+}
+
+/* Runs on launch_stack: starts the first shell of a terminal. execute()
+ * only comes back if that failed, then the terminal stays empty and the
+ * process that was switched away from resumes. */
+static void launch_shell() {
+    execute("shell");
+    active_terminal = previous_terminal;
+    set_terminal_vmem(active_terminal);
+    kernel_context_switch(&launch_esp[smp_this_cpu()->index],
+                          processes[terminals[active_terminal].pid]->context_esp);
 }
 
 /* void switch_to_process()
@@ -230,30 +557,82 @@ int32_t vidmap(uint8_t **screen_start) {
  * terminals[active_terminal].pid contains the pid that needs to be switched to.  
  */
 void switch_to_process() {
-    /* Save the current ESP and EBP in the previous processes PCB for switching back to it */
-    asm volatile (
-        "movl %%esp, %0;"
-        "movl %%ebp, %1;"
-        :"=g"(processes[terminals[previous_terminal].pid]->context_esp), "=g"(processes[terminals[previous_terminal].pid]->context_ebp)
-    );
-    /* save current process tss info */
-    processes[terminals[previous_terminal].pid]->context_esp0 = tss.esp0;
-
-    /* if there isnt a process running in the terminal that's being switched to, launch one and return*/
-    if (processes[terminals[active_terminal].pid] == 0) {execute("shell"); return;}
+    uint8_t from = terminals[previous_terminal].pid;
+    uint32_t* frame;
 
-    /* update tss for incoming process*/
-    tss.esp0 = processes[terminals[active_terminal].pid]->context_esp0;
+    /* if there isnt a process running in the terminal that's being switched to, launch one
+     * on the spare stack, so the previous process can be resumed like any other */
+    if (!terminals[active_terminal].pid) {
+        frame = (uint32_t*)(launch_stack[smp_this_cpu()->index] + PROCESS_KERNEL_STACK_SIZE);
+        *--frame = 0;  // launch_shell never returns
+        *--frame = (uint32_t)launch_shell;
+        *--frame = 0;  // ebp
+        *--frame = 0;  // ebx
+        *--frame = 0;  // esi
+        *--frame = 0;  // edi
+        processes[from]->context_esp0 = smp_this_cpu()->tss->esp0;
+        processes[from]->switch_count++;
+        kernel_context_switch(&processes[from]->context_esp, (uint32_t)frame);
+        return;
+    }
+    process_switch(from, terminals[active_terminal].pid);
+}
 
-    /* set up paging appropriately for the process being switched to*/
-    set_page_for_process(terminals[active_terminal].pid);
+/**
+ * Switches between the processes of the active terminal: its foreground
+ * one and its background jobs.
+ * INPUT: pid: Process to run, on the active terminal
+ * OUTPUT: None
+ * EFFECT: Called from irq_exit with interrupts off.
+ */
+void switch_terminal_process(uint8_t pid) {
+    uint8_t from = terminals[active_terminal].pid;
+    if (pid == from) return;
+    terminals[active_terminal].pid = pid;
+    process_switch(from, pid);
+}
 
-    /* load the stack registers appropriately for the return to the new process  */
-        asm volatile (
-        "movl %0, %%esp;"
-        "movl %1, %%ebp;"
-        :
-        :"g"(processes[terminals[active_terminal].pid]->context_esp), "g"(processes[terminals[active_terminal].pid]->context_ebp)
-    );
-    return;
+/**
+ * Waits for a background child to halt and collects its exit status.
+ * INPUT: pid: Child to wait for, WAIT_ANY for whichever halts first
+ *        status: Where the exit status goes, may be NULL
+ *        options: WAIT_NOHANG to return 0 instead of sleeping
+ * OUTPUT: PID of the child reaped, 0 with WAIT_NOHANG if none halted yet,
+ *         -1 if there is no such background child or status is bad
+ * EFFECT: Sleeps on its own PCB, halt() wakes it.
+ */
+int32_t waitpid(int32_t pid, int32_t *status, int32_t options) {
+    uint8_t self = terminals[active_terminal].pid;
+    uint8_t child, found, reaped = 0;
+    int32_t code;
+    if (status && !user_range_ok(status, sizeof(*status))) return -1;
+    if (pid != WAIT_ANY && (pid < MIN_PID || pid >= (int32_t)num_pids)) return -1;
+    irqoff_cli();
+    while (1) {
+        found = 0;
+        for (child = MIN_PID; child < num_pids; child++) {
+            if (pid != WAIT_ANY && child != pid) continue;
+            if (!processes[child]->in_use || !processes[child]->background ||
+                processes[child]->parent_pid != self)
+                continue;
+            found = 1;
+            if (processes[child]->zombie) {
+                reaped = child;
+                break;
+            }
+        }
+        if (reaped || !found || (options & WAIT_NOHANG)) break;
+        sched_sleep_on(processes[self]);
+    }
+    sched_wait_done();
+    if (reaped) {
+        code = processes[reaped]->exit_status;
+        processes[reaped]->zombie = 0;
+        processes[reaped]->in_use = 0;
+        processes[reaped]->parent_pid = NULL;
+    }
+    irqoff_sti();
+    if (!found) return -1;
+    if (reaped && status && copy_to_user(status, &code, sizeof(code))) return -1;
+    return reaped;
 }
@@ -6,11 +6,16 @@
 
 #include "../lib.h"
 #include "../driver/terminal.h"
+#include "signal.h"
+#include "fpu.h"
 
 /* We have 9 processes, 0 is the ghostd process that doesn't exist.
  * Just kidding. Reserwe 0 (NULL) for "no process"
+ * PCBs and user pages both come from the frame allocator when a PID is
+ * first needed, so free memory is what really limits the process count.
+ * This only keeps PIDs inside a uint8_t with loop counters to spare.
  */
-#define NUM_PROCESSES 7
+#define PID_LIMIT 255
 #define MIN_PID 1
 #define NUM_FILE_DESCRIPTORS 8
 /* First four bytes of the executable, little endian uint32*/
@@ -19,11 +24,20 @@
 #define PROCESS_LD_LOCATION 0x08048000
 #define PROCESS_START_LOCATION 0x08000000
 #define PROCESS_ESP_LOCATION 0x083FFFFC
+#define USER_PDE_INDEX (PROCESS_START_LOCATION >> 22)
 #define PROCESS_EIP_LOCATION 24  // 24-27, entrypoint
 #define PROCESS_HEADER_BLOCK_LENGTH 28  // Contains EIP and things
+#define PROCESS_NAME_LENGTH 33  // Filesystem names are up to 32 chars
 
-#define KERNEL_AREA_BOTTOM 0x800000  /* End of kernel memory: 8MB */
 #define PROCESS_KERNEL_STACK_SIZE 0x2000  /* Per-process stack: 8kB */
+/* Kernel-only 4MB window the PCBs are mapped in, 8kB per PID with the PCB
+ * at the bottom and the kernel stack growing down from the top */
+#define PCB_PDE_INDEX 36  /* 144MB */
+#define PCB_ADDR(pid) ((PCB_PDE_INDEX << 22) + (pid) * PROCESS_KERNEL_STACK_SIZE)
+
+/* waitpid options */
+#define WAIT_ANY -1  /* pid: any background child */
+#define WAIT_NOHANG 1  /* Return 0 instead of sleeping */
 
 #define FD_STDIN 0
 #define FD_STDOUT 1
@@ -32,8 +46,12 @@
 #define DRIVER_RTC 1
 #define DRIVER_FILE 2
 #define DRIVER_DIR 3
+#define DRIVER_PIPE_READ 4
+#define DRIVER_PIPE_WRITE 5
+#define DRIVER_PROC 6
+#define DRIVER_SERIAL 7
 // FIXME: Filesystem is excluded for the time being
-#define DRIVER_COUNT 4
+#define DRIVER_COUNT 8
 
 typedef struct {
     /* Ops table location for syscall on the open file */
@@ -51,23 +69,59 @@ typedef struct {
     uint8_t pid;  /* Process ID, 1 to 8 */
     uint32_t esp0;
     uint8_t parent_pid;
+    uint8_t terminal;  /* Terminal it was started on */
+    uint8_t exec_child;  /* Foreground child it waits for in execute(), 0 if none */
+    uint8_t background;  /* Started with &: runs beside its parent, reaped by waitpid */
+    uint8_t zombie;  /* Halted background process, kept until waitpid or
+                      * the parent's next execute */
+    uint8_t exit_status;
     int8_t args[SIZE_INPUT_BUFFER];  /* Argument string */
     file_descriptor_t file_descriptors[NUM_FILE_DESCRIPTORS];
     uint32_t parent_esp;
     uint32_t parent_ebp;
     uint32_t context_esp0;
-    uint32_t context_esp;
-    uint32_t context_ebp;
+    uint32_t context_esp;  /* Parked by context_switch while it isn't running */
+    uint32_t user_frame;  /* Physical 4MB frame mapped at 128MB */
+    uint32_t shm_attached;  /* Bitmask of attached shm segments */
+    void* signal_handlers[NUM_SIGNALS];  /* NULL = default action */
+    uint32_t signal_pending;  /* Bitmask by signal number */
+    uint8_t signal_masked;  /* Set while a handler runs */
+    uint32_t alarm_remaining;  /* PIT ticks until the next ALARM */
+    uint64_t signal_raised_tsc[NUM_SIGNALS];  /* For delivery latency */
+    uint8_t waiting;  /* Asleep in sched_sleep_on, skipped by the scheduler */
+    void* wait_channel;  /* What it waits for, see sched_wakeup */
+    /* Accounting, shown by proc/top */
+    int8_t name[PROCESS_NAME_LENGTH];  /* Executable name */
+    uint64_t user_ticks;  /* PIT ticks that caught it in user mode */
+    uint64_t kernel_ticks;  /* ... and in the kernel, not counting sleep */
+    uint32_t syscall_count;
+    uint32_t switch_count;  /* Times the scheduler switched away from it */
+    uint8_t fpu_used;  /* fpu_state holds something worth restoring */
+    uint8_t last_cpu;  /* Where it last ran, sched_balance tries it first */
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
 } pcb_t;
 
 /* Quick access PCB locations for each process.
- * Since pid 0 doesn't exist, this is only for 1-8.
+ * Since pid 0 doesn't exist, this is only for 1 to num_pids - 1.
  */
-extern pcb_t* processes[NUM_PROCESSES];
+extern pcb_t* processes[PID_LIMIT];
+/* One past the highest PID that has a PCB yet, loops over processes stop
+ * here. Only grows. */
+extern volatile uint32_t num_pids;
 
 int32_t execute(const str command);
 int32_t halt(uint8_t status);
 void switch_to_process();
+void switch_terminal_process(uint8_t pid);
+/* Runs a process parked by process_switch on a CPU that had none, saving
+ * the caller's context in save_esp. Doesn't come back. */
+void process_resume(uint8_t pid, uint32_t* save_esp);
+/* Points the calling CPU's 128MB page at the user frame of pid */
+void map_user_page(uint8_t pid);
+/* Claims a free PID, creating its PCB if needed. 0 if none is left. */
+uint8_t alloc_pid(void);
+int32_t waitpid(int32_t pid, int32_t *status, int32_t options);
+void process_count_syscall();
 
 extern void init_pcb();
 
@@ -0,0 +1,264 @@
+/**
+ * Scheduler helpers.
+ * A process that waits for input marks itself waiting and halts the CPU
+ * instead of spinning. The PIT scheduler skips waiting processes, and when
+ * nothing at all is runnable it parks the CPU in a dedicated idle context
+ * that runs hlt with interrupts enabled. Each CPU schedules its own
+ * terminals and has its own idle context; a CPU with more runnable
+ * terminals than it can run hands one to an idle CPU.
+ */
+#include "sched.h"
+#include "process.h"
+#include "../lib.h"
+#include "../smp.h"
+#include "../driver/terminal.h"
+#include "../irqoff.h"
+#include "fpu.h"
+
+volatile uint64_t sched_total_ticks = 0;
+volatile uint64_t sched_idle_ticks = 0;
+
+static uint8_t idle_stack[SMP_MAX_CPUS][SCHED_IDLE_STACK_SIZE] __attribute__((aligned(16)));
+static uint32_t idle_return_esp[SMP_MAX_CPUS];  /* Process context parked while idling */
+static uint32_t idle_esp[SMP_MAX_CPUS];  /* Idle context when it hands the CPU back */
+
+/* Returns the PCB of the running process, NULL in early kernel context */
+static pcb_t* sched_current_pcb() {
+    uint8_t pid = terminals[active_terminal].pid;
+    return pid ? processes[pid] : NULL;
+}
+
+/* Not asleep, not a zombie and not parked in execute() under a child */
+static int32_t sched_process_runnable(uint8_t pid) {
+    pcb_t* pcb = processes[pid];
+    return pcb->in_use && !pcb->zombie && !pcb->waiting && !pcb->exec_child;
+}
+
+/* An empty terminal counts as runnable: switching to it launches a shell.
+ * Terminals nobody has visited yet are skipped, so they cost no CPU time. */
+static int32_t sched_terminal_runnable(int32_t terminal) {
+    if (!terminals[terminal].ready) return 0;
+    return !terminals[terminal].pid || sched_pick_process(terminal);
+}
+
+/**
+ * Round robin over the processes of a terminal: the foreground one and
+ * the background jobs started from it.
+ * INPUT: terminal: Terminal to pick for
+ * OUTPUT: First runnable PID after the one the terminal ran last, 0 if
+ *         none is
+ */
+uint8_t sched_pick_process(int32_t terminal) {
+    uint8_t pid;
+    uint32_t i;
+    for (i = 1; i <= num_pids; i++) {
+        pid = (terminals[terminal].pid + i) % num_pids;
+        if (pid && processes[pid]->terminal == terminal &&
+            sched_process_runnable(pid))
+            return pid;
+    }
+    return 0;
+}
+
+/**
+ * Round robin over the visited terminals of the calling CPU, skipping
+ * ones whose process waits.
+ * INPUT: None
+ * OUTPUT: Terminal to run next, the active one if it's the only runnable
+ *         one, -1 if everybody waits
+ */
+int32_t sched_pick_next() {
+    int32_t i, terminal;
+    uint32_t cpu = smp_this_cpu()->index;
+    for (i = 1; i <= NUM_TERMINALS; i++) {
+        terminal = (active_terminal + i) % NUM_TERMINALS;
+        if (smp_terminal_cpu(terminal) != cpu) continue;
+        if (sched_terminal_runnable(terminal)) return terminal;
+    }
+    return -1;
+}
+
+/* Can take a terminal right now: halted in its idle context, or an AP
+ * that never ran a process */
+static int32_t sched_cpu_idle(uint32_t cpu) {
+    return cpus[cpu].online && (cpus[cpu].in_idle || !cpus[cpu].scheduling);
+}
+
+/* Whether esp is on the kernel stack of pid, in the PCB window */
+static int32_t sched_on_own_stack(uint8_t pid, uint32_t esp) {
+    return esp >= PCB_ADDR(pid) && esp < PCB_ADDR(pid) + PROCESS_KERNEL_STACK_SIZE;
+}
+
+/* Every process of a terminal is parked on a stack any CPU can resume:
+ * its own, and its parent's for one that halt() returns to. Kernel code
+ * standing in for a process, like the boot code, isn't, and stays put. */
+static int32_t sched_terminal_movable(int32_t terminal) {
+    uint8_t pid;
+    pcb_t* pcb;
+    for (pid = MIN_PID; pid < num_pids; pid++) {
+        pcb = processes[pid];
+        if (!pcb->in_use || pcb->zombie || pcb->terminal != terminal) continue;
+        if (!pcb->exec_child && !sched_on_own_stack(pid, pcb->context_esp))
+            return 0;
+        if (!pcb->background && pcb->parent_pid &&
+            !sched_on_own_stack(pcb->parent_pid, pcb->parent_esp))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Hands one of the calling CPU's runnable terminals to an idle CPU, when
+ * the active one has something to run as well.
+ * INPUT: None
+ * OUTPUT: 1 if a terminal moved, 0 otherwise
+ * EFFECT: Called from irq_exit with interrupts off and the kernel lock
+ *         held. The terminal's processes are parked in process_switch with
+ *         their kernel stacks in the PCB window, which every CPU maps, so
+ *         the new owner resumes them from context_esp like this CPU would.
+ *         Only the FPU registers have to come out first. The CPU the
+ *         process last ran on is tried first, its caches may still be warm.
+ */
+int32_t sched_balance() {
+    cpu_t* self = smp_this_cpu();
+    int32_t i, terminal = 0;
+    uint32_t target;
+    if (!smp_steal_enable || smp_num_cpus == 1 ||
+        !sched_pick_process(active_terminal))
+        return 0;
+    for (i = 1; i < NUM_TERMINALS; i++) {
+        terminal = (active_terminal + i) % NUM_TERMINALS;
+        if (smp_terminal_cpu(terminal) == self->index && terminals[terminal].pid &&
+            sched_terminal_runnable(terminal) && sched_terminal_movable(terminal))
+            break;
+    }
+    if (i == NUM_TERMINALS) return 0;
+    target = processes[sched_pick_process(terminal)]->last_cpu;
+    if (target == self->index || !sched_cpu_idle(target)) {
+        for (target = 0; target < smp_num_cpus; target++)
+            if (target != self->index && sched_cpu_idle(target)) break;
+        if (target == smp_num_cpus) return 0;
+    }
+    fpu_save_terminal(terminal);
+    self->migrations++;
+    smp_set_terminal_cpu(terminal, target);
+    return 1;
+}
+
+/**
+ * Counts a PIT tick for utilization accounting.
+ * INPUT: None
+ * OUTPUT: 1 if the tick arrived while idling, 0 otherwise
+ */
+int32_t sched_tick() {
+    pcb_t* pcb;
+    sched_total_ticks++;
+    if (sched_in_idle) {
+        sched_idle_ticks++;
+        return 1;
+    }
+    // A process halted in sched_sleep_on is idle time as well
+    pcb = sched_current_pcb();
+    if (pcb && pcb->waiting) sched_idle_ticks++;
+    return 0;
+}
+
+/* Body of the idle context. Interrupts stay on while halted; after each
+ * wakeup, run kernel tasks queued on this CPU, then check with interrupts
+ * off whether someone became runnable. The kernel lock is only held for
+ * that check, the other CPUs keep going meanwhile. */
+static void idle_loop() {
+    uint32_t cpu = smp_this_cpu()->index;
+    kernel_unlock_all();
+    while (1) {
+        irqoff_end();
+        asm volatile("sti; hlt" : : : "memory");
+        do {
+            smp_run_pending();
+        } while (smp_steal());
+        irqoff_cli();
+        kernel_relock(1);
+        if (sched_pick_next() != -1)
+            kernel_context_switch(&idle_esp[cpu], idle_return_esp[cpu]);
+        kernel_unlock_all();
+    }
+}
+
+/**
+ * Parks the running process and idles until something is runnable.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: Must be called with interrupts off (from irq_exit).
+ *         Returns in the same process once a wakeup happened.
+ */
+void sched_idle() {
+    uint32_t cpu = smp_this_cpu()->index;
+    uint32_t* frame = (uint32_t*)(idle_stack[cpu] + SCHED_IDLE_STACK_SIZE);
+    // Start from a clean idle stack every time, see context_switch.S
+    *--frame = 0;  // idle_loop never returns
+    *--frame = (uint32_t)idle_loop;
+    *--frame = 0;  // ebp
+    *--frame = 0;  // ebx
+    *--frame = 0;  // esi
+    *--frame = 0;  // edi
+    sched_in_idle = 1;
+    kernel_context_switch(&idle_return_esp[cpu], (uint32_t)frame);
+    sched_in_idle = 0;
+}
+
+/**
+ * Waits for a wakeup on a channel, halting the CPU in the meantime.
+ * INPUT: channel: Address identifying what is waited for
+ * OUTPUT: None
+ * EFFECT: Called and returns with interrupts off. sti right before hlt
+ *         means a wakeup can't slip in between the caller's check and
+ *         the halt.
+ */
+void sched_sleep_on(void *channel) {
+    IRQOFF_SITE(woken);
+    uint32_t depth;
+    pcb_t* pcb = sched_current_pcb();
+    if (pcb) {
+        pcb->wait_channel = channel;
+        pcb->waiting = 1;
+    }
+    irqoff_end();
+    depth = kernel_unlock_all();
+    asm volatile("sti; hlt; cli" : : : "memory");
+    kernel_relock(depth);
+    irqoff_begin(&woken);
+}
+
+/**
+ * Marks the running process runnable again after its wait loop ended.
+ * INPUT: None
+ * OUTPUT: None
+ */
+void sched_wait_done() {
+    pcb_t* pcb = sched_current_pcb();
+    if (pcb) {
+        pcb->waiting = 0;
+        pcb->wait_channel = NULL;
+    }
+}
+
+/**
+ * Makes every process sleeping on a channel runnable.
+ * INPUT: channel: Same address the sleepers passed to sched_sleep_on
+ * OUTPUT: None
+ * EFFECT: A sleeper's terminal may be on another CPU, that CPU gets out
+ *         of hlt.
+ */
+void sched_wakeup(void *channel) {
+    uint8_t pid;
+    uint32_t flags;
+    irqoff_save(flags);
+    for (pid = MIN_PID; pid < num_pids; pid++) {
+        if (processes[pid]->waiting && processes[pid]->wait_channel == channel) {
+            processes[pid]->waiting = 0;
+            processes[pid]->wait_channel = NULL;
+            smp_kick(smp_terminal_cpu(processes[pid]->terminal));
+        }
+    }
+    irqoff_restore(flags);
+}
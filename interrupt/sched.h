@@ -0,0 +1,47 @@
+/**
+ * Scheduler helpers: picking the next terminal, sleeping on events,
+ * and the idle context.
+ */
+#pragma once
+
+#include "../types.h"
+#include "../smp.h"
+
+#define SCHED_IDLE_STACK_SIZE 0x1000
+
+/* PIT ticks seen in total and while idling, for utilization */
+extern volatile uint64_t sched_total_ticks;
+extern volatile uint64_t sched_idle_ticks;
+/* Set while the calling CPU sits in its idle context */
+#define sched_in_idle (smp_this_cpu()->in_idle)
+
+extern void context_switch(uint32_t *save_esp, uint32_t next_esp);
+/* Where a background process first gets the CPU, see context_switch.S */
+extern void process_first_run(void);
+
+/* Next terminal of the calling CPU with something runnable after the
+ * active one, -1 if none */
+int32_t sched_pick_next(void);
+
+/* Next runnable process of a terminal after the one it ran last, that one
+ * again if it's the only runnable one, 0 if none is */
+uint8_t sched_pick_process(int32_t terminal);
+
+/* Hands a spare runnable terminal of the calling CPU to an idle CPU.
+ * Returns 1 if one moved. */
+int32_t sched_balance(void);
+
+/* Parks the calling CPU in its idle context until something of its
+ * terminals becomes runnable */
+void sched_idle(void);
+
+/* Counts a PIT tick, returns 1 if it arrived while idling */
+int32_t sched_tick(void);
+
+/* Sleep/wakeup. Callers hold interrupts off while testing their condition:
+ *   cli(); while (!cond) sched_sleep_on(chan); sched_wait_done(); sti();
+ * and whoever makes cond true calls sched_wakeup(chan).
+ */
+void sched_sleep_on(void *channel);
+void sched_wait_done(void);
+void sched_wakeup(void *channel);
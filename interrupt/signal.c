@@ -0,0 +1,211 @@
+/**
+ * Signal delivery.
+ * Signals are only ever delivered on the way back to user mode, from
+ * interrupt_return in isr.S. A caught signal rewrites the interrupt frame so
+ * that the iret lands in the user handler, with a copy of the interrupted
+ * frame and a small sigreturn trampoline left on the user stack.
+ */
+#include "signal.h"
+#include "process.h"
+#include "syscall.h"
+#include "vectors.h"
+#include "../lib.h"
+#include "../tsc.h"
+#include "../x86_desc.h"
+#include "../driver/pit.h"
+#include "../driver/terminal.h"
+#include "../irqoff.h"
+#include "../uaccess.h"
+
+#define SIGNAL_ALARM_TICKS (SIGNAL_ALARM_SECONDS * PIT_TICK_RATE)
+#define USER_PAGE_BOTTOM PROCESS_START_LOCATION
+#define USER_PAGE_TOP (PROCESS_START_LOCATION + 0x400000)
+#define EFLAGS_IF 0x200
+#define EFLAGS_IOPL 0x3000
+#define SYS_SIGRETURN 10
+
+/* movl $SYS_SIGRETURN, %eax; int $0x80; padded to a dword */
+static const uint8_t sigreturn_trampoline[8] = {
+    0xB8, SYS_SIGRETURN, 0x00, 0x00, 0x00, 0xCD, 0x80, 0x90};
+
+signal_stats_t signal_stats = {0, 0, 0xFFFFFFFF, 0};
+
+/**
+ * Marks a signal pending on a process.
+ * INPUT: pid: Target process, 0 is ignored
+ *        signum: Signal number
+ * OUTPUT: None
+ */
+void signal_raise(uint8_t pid, uint8_t signum) {
+    uint32_t flags;
+    if (!pid || pid >= num_pids || signum >= NUM_SIGNALS) return;
+    if (!processes[pid]->in_use) return;
+    irqoff_save(flags);
+    if (!(processes[pid]->signal_pending & (1 << signum)))
+        processes[pid]->signal_raised_tsc[signum] = rdtsc();
+    processes[pid]->signal_pending |= (1 << signum);
+    irqoff_restore(flags);
+}
+
+/**
+ * Checks whether a process would run its own handler for a signal.
+ * INPUT: pid: Process, signum: Signal number
+ * OUTPUT: 1 if a handler is installed and signals aren't masked, else 0
+ */
+int32_t signal_catchable(uint8_t pid, uint8_t signum) {
+    if (!pid || signum >= NUM_SIGNALS) return 0;
+    return processes[pid]->signal_handlers[signum] != NULL &&
+           !processes[pid]->signal_masked;
+}
+
+/**
+ * Resets signal state for a process. Used by init_pcb and execute.
+ * INPUT: pid: Process to reset
+ * OUTPUT: None
+ */
+void signal_init_process(uint8_t pid) {
+    int i;
+    for (i = 0; i < NUM_SIGNALS; i++)
+        processes[pid]->signal_handlers[i] = NULL;
+    processes[pid]->signal_pending = 0;
+    processes[pid]->signal_masked = 0;
+    processes[pid]->alarm_remaining = SIGNAL_ALARM_TICKS;
+}
+
+/**
+ * Counts down every process's ALARM. Called on each PIT tick.
+ * INPUT: None
+ * OUTPUT: None
+ */
+void signal_tick() {
+    uint8_t pid;
+    for (pid = MIN_PID; pid < num_pids; pid++) {
+        if (!processes[pid]->in_use) continue;
+        if (!--processes[pid]->alarm_remaining) {
+            processes[pid]->alarm_remaining = SIGNAL_ALARM_TICKS;
+            signal_raise(pid, SIG_ALARM);
+        }
+    }
+}
+
+/* Default actions: ALARM and USER1 are ignored, the rest kill the task */
+static void signal_default_action(uint8_t signum) {
+    if (signum == SIG_ALARM || signum == SIG_USER1) return;
+    halt(255);
+}
+
+/* Returns 1 if [addr, addr+len) sits inside the user program page */
+static int32_t signal_user_range_ok(uint32_t addr, uint32_t len) {
+    return addr >= USER_PAGE_BOTTOM && addr + len <= USER_PAGE_TOP &&
+           addr + len >= addr;
+}
+
+/**
+ * Delivers the lowest numbered pending signal of the current process.
+ * INPUT: context: The frame about to be restored by iret
+ * OUTPUT: None
+ * EFFECT: For a caught signal, pushes onto the user stack (top to bottom)
+ *         the trampoline, a copy of the frame, the signal number and a
+ *         return address pointing at the trampoline, then points the frame
+ *         at the handler.
+ */
+void deliver_signals(hw_context_t *context) {
+    uint8_t pid, signum;
+    uint32_t user_esp, trampoline, cycles;
+    uint32_t words[2];
+    pcb_t* pcb;
+    // Fast path: kernel frames and processes without pending signals
+    if (context->cs != USER_CS) return;
+    pid = terminals[active_terminal].pid;
+    if (!pid) return;
+    pcb = processes[pid];
+    if (!pcb->signal_pending || pcb->signal_masked) return;
+
+    for (signum = 0; signum < NUM_SIGNALS; signum++)
+        if (pcb->signal_pending & (1 << signum)) break;
+    pcb->signal_pending &= ~(1 << signum);
+
+    if (!pcb->signal_handlers[signum]) {
+        signal_default_action(signum);
+        return;
+    }
+
+    // STEP 1: Make sure the frame fits on the user stack
+    user_esp = context->esp;
+    if (!signal_user_range_ok(user_esp - sizeof(sigreturn_trampoline) -
+                              sizeof(hw_context_t) - 8,
+                              sizeof(sigreturn_trampoline) +
+                              sizeof(hw_context_t) + 8)) {
+        halt(255);
+        return;
+    }
+    // STEP 2: Trampoline code. The stack page may be gone, which kills
+    // the process like the fault would have.
+    user_esp -= sizeof(sigreturn_trampoline);
+    trampoline = user_esp;
+    // STEP 3: Interrupted frame, for sigreturn
+    user_esp -= sizeof(hw_context_t);
+    // STEP 4: Return address and handler argument
+    user_esp -= 8;
+    words[0] = trampoline;
+    words[1] = signum;
+    if (__copy_user((void*)trampoline, sigreturn_trampoline,
+                    sizeof(sigreturn_trampoline)) ||
+        __copy_user((void*)(user_esp + 8), context, sizeof(hw_context_t)) ||
+        __copy_user((void*)user_esp, words, sizeof(words))) {
+        halt(255);
+        return;
+    }
+    // STEP 5: Point iret at the handler
+    context->esp = user_esp;
+    context->eip = (uint32_t)pcb->signal_handlers[signum];
+    pcb->signal_masked = 1;
+
+    cycles = (uint32_t)(rdtsc() - pcb->signal_raised_tsc[signum]);
+    signal_stats.delivered++;
+    signal_stats.last_cycles = cycles;
+    if (cycles < signal_stats.min_cycles) signal_stats.min_cycles = cycles;
+    if (cycles > signal_stats.max_cycles) signal_stats.max_cycles = cycles;
+}
+
+/**
+ * Installs a user handler for a signal.
+ * INPUT: signum: Signal number
+ *        handler_address: User function, NULL restores the default action
+ * OUTPUT: 0 on success, -1 on a bad signal number
+ */
+int32_t set_handler(uint32_t signum, void *handler_address) {
+    uint8_t pid = terminals[active_terminal].pid;
+    if (signum >= NUM_SIGNALS) return -1;
+    if (handler_address &&
+        !signal_user_range_ok((uint32_t)handler_address, 1)) return -1;
+    processes[pid]->signal_handlers[signum] = handler_address;
+    return 0;
+}
+
+/**
+ * Returns from a signal handler, reached through the trampoline.
+ * INPUT: context: The syscall frame (fourth argument pushed by
+ *                 handle_syscall). Its user esp points at the signal number,
+ *                 with the saved frame right above it.
+ * OUTPUT: The interrupted eax, so the syscall return path restores it
+ * EFFECT: Restores the interrupted frame and unmasks signals.
+ */
+int32_t sigreturn(int32_t unused1, int32_t unused2, int32_t unused3,
+                  hw_context_t *context) {
+    uint8_t pid = terminals[active_terminal].pid;
+    uint32_t saved_addr = context->esp + 4;
+    hw_context_t* saved = (hw_context_t*)saved_addr;
+    hw_context_t copy;
+    if (!signal_user_range_ok(saved_addr, sizeof(hw_context_t))) return -1;
+    // Copied aside first so a fault halfway leaves the frame untouched
+    if (__copy_user(&copy, saved, sizeof(hw_context_t))) return -1;
+    memcpy(context, &copy, sizeof(hw_context_t));
+    // Never let user code hand us a kernel segment or IOPL
+    context->cs = USER_CS;
+    context->ss = USER_DS;
+    context->eflags = (context->eflags | EFLAGS_IF) & ~EFLAGS_IOPL;
+    context->vector = VEC_SYSCALL;
+    processes[pid]->signal_masked = 0;
+    return context->eax;
+}
@@ -0,0 +1,44 @@
+/**
+ * Signal delivery: set_handler, sigreturn, and the user stack trampoline.
+ */
+
+#pragma once
+
+#include "../types.h"
+#include "handler.h"
+
+#define SIG_DIV_ZERO 0
+#define SIG_SEGFAULT 1
+#define SIG_INTERRUPT 2
+#define SIG_ALARM 3
+#define SIG_USER1 4
+#define SIG_ILLEGAL 5  /* Invalid opcode */
+#define NUM_SIGNALS 6
+
+/* ALARM fires every 10 seconds worth of PIT ticks */
+#define SIGNAL_ALARM_SECONDS 10
+
+/* Delivery latency (raise to handler frame built), in TSC cycles */
+typedef struct {
+  uint32_t delivered;
+  uint32_t last_cycles;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+} signal_stats_t;
+
+extern signal_stats_t signal_stats;
+
+/* Marks a signal pending on a process. Safe from interrupt context. */
+void signal_raise(uint8_t pid, uint8_t signum);
+
+/* Returns 1 if the process has a user handler that can take signum now */
+int32_t signal_catchable(uint8_t pid, uint8_t signum);
+
+/* Resets the signal state of a freshly executed process */
+void signal_init_process(uint8_t pid);
+
+/* Called from the timer bottom half to drive ALARM */
+void signal_tick(void);
+
+/* Called from interrupt_return, delivers one pending signal if any */
+void deliver_signals(hw_context_t *context);
@@ -5,10 +5,12 @@
 #pragma once
 
 #include "../types.h" // For int32_t etc.
+#include "handler.h" // For hw_context_t
 
 extern void handle_syscall(); //assembly syscall linkages
 
 extern int32_t execute(const str command);
+extern int32_t sys_execute(const str command);
 extern int32_t halt(uint8_t status);
 extern int32_t read(int32_t fd, void *buf, int32_t nbytes);
 extern int32_t write(int32_t fd, const void *buf, int32_t nbytes);
@@ -18,6 +20,15 @@ extern int32_t getargs(str buf, int32_t nbytes);
 //extern int32_t vidmap(str *screen_start);
 extern int32_t map_addr_video_memory(uint8_t ** screen_start);
 
+extern int32_t pipe(int32_t *fds);
+extern int32_t shmget(int32_t key, uint32_t size);
+extern int32_t shmat(int32_t shmid);
+extern int32_t shmdt(int32_t shmid);
+extern int32_t trace_dump(void *buf, int32_t nbytes);
+extern int32_t waitpid(int32_t pid, int32_t *status, int32_t options);
+
 // Extra Credit
 extern int32_t set_handler(uint32_t signum, void *handler_address);
-extern int32_t sigreturn(void);
+// sigreturn gets the syscall frame as a hidden 4th argument
+extern int32_t sigreturn(int32_t unused1, int32_t unused2, int32_t unused3,
+                         hw_context_t *context);
@@ -3,39 +3,51 @@
 #include "../types.h"    // Import the uint32_t and stuff
 #include "../x86_desc.h" // Import idt_desc_t and NUM_VEC
 #include "handler.h"     // Interrupt handlers
+#include "irq.h"         // IRQ entry stubs
 #include "syscall.h"     // syscallhandler
 #include "vectors.h"     // Interrupt vector magic numbers
+#include "../boottime.h"
+
+/* Second dword of a gate with the checklist below already applied:
+ * present, DPL 0, 32 bit, reserved3 picks a trap over an interrupt gate */
+#define IDT_GATE_INTERRUPT 0x8E00
+#define IDT_GATE_TRAP 0x8F00
+#define IDT_GATE_DPL_USER 0x6000
 
 // BEGIN CP1.3
-// Define all the exception handlers here.
-// For the reasoning behind this, see handler.h:24
-DEF_HANDLE_EXC_PARTIAL(EXC_DIVIDE)
-DEF_HANDLE_EXC_PARTIAL(EXC_NMI)
-DEF_HANDLE_EXC_PARTIAL(EXC_BREAKPOINT)
-DEF_HANDLE_EXC_PARTIAL(EXC_OVERFLOW)
-DEF_HANDLE_EXC_PARTIAL(EXC_BOUND)
-DEF_HANDLE_EXC_PARTIAL(EXC_INVALID_OP)
-DEF_HANDLE_EXC_PARTIAL(EXC_DEVICE_NOT_AVAIL)
-DEF_HANDLE_EXC_PARTIAL(EXC_DOUBLE_FAULT)
-DEF_HANDLE_EXC_PARTIAL(EXC_INVALID_TSS)
-DEF_HANDLE_EXC_PARTIAL(EXC_SEG_NOT_PRESENT)
-DEF_HANDLE_EXC_PARTIAL(EXC_STACK_SEGFAULT)
-DEF_HANDLE_EXC_PARTIAL(EXC_GP_FAULT)
-DEF_HANDLE_EXC_PARTIAL(EXC_PAGE_FAULT)
-DEF_HANDLE_EXC_PARTIAL(EXC_ASSERTION_FAILURE)
-DEF_HANDLE_EXC_PARTIAL(EXC_MATH_FAULT)
-DEF_HANDLE_EXC_PARTIAL(EXC_ALIGNMENT_FAULT)
-DEF_HANDLE_EXC_PARTIAL(EXC_MACHINE_ABORT)
+// Declare all the exception entry stubs here.
+// For the reasoning behind this, see handler.h
+DECL_HANDLE_EXC_STUB(EXC_DIVIDE)
+DECL_HANDLE_EXC_STUB(EXC_NMI)
+DECL_HANDLE_EXC_STUB(EXC_BREAKPOINT)
+DECL_HANDLE_EXC_STUB(EXC_OVERFLOW)
+DECL_HANDLE_EXC_STUB(EXC_BOUND)
+DECL_HANDLE_EXC_STUB(EXC_INVALID_OP)
+DECL_HANDLE_EXC_STUB(EXC_DEVICE_NOT_AVAIL)
+DECL_HANDLE_EXC_STUB(EXC_DOUBLE_FAULT)
+DECL_HANDLE_EXC_STUB(EXC_INVALID_TSS)
+DECL_HANDLE_EXC_STUB(EXC_SEG_NOT_PRESENT)
+DECL_HANDLE_EXC_STUB(EXC_STACK_SEGFAULT)
+DECL_HANDLE_EXC_STUB(EXC_GP_FAULT)
+DECL_HANDLE_EXC_STUB(EXC_PAGE_FAULT)
+DECL_HANDLE_EXC_STUB(EXC_ASSERTION_FAILURE)
+DECL_HANDLE_EXC_STUB(EXC_MATH_FAULT)
+DECL_HANDLE_EXC_STUB(EXC_ALIGNMENT_FAULT)
+DECL_HANDLE_EXC_STUB(EXC_MACHINE_ABORT)
 
 /**
- * Initializes the IDT Table.
+ * Builds the IDT and loads it.
  *
  * INPUT: none
  * OUTPUT: none
- * SIDE EFFECT: Populates the IDT Table.
+ * SIDE EFFECT: Populates the IDT Table. Doesn't mark a boot phase, so
+ *              benchmarks can call it as often as they like.
  */
-void init_idt() {
+void build_idt() {
   int i;
+  uint32_t offset = (uint32_t)default_interrupt;
+  uint32_t low = (KERNEL_CS << 16) | (offset & 0xFFFF);
+  uint32_t high = offset & 0xFFFF0000;
   for (i = 0; i < NUM_VEC; i++) {
     /* Setup Checklist:
      * - seg_selector: KERNEL_CS
@@ -45,22 +57,20 @@ void init_idt() {
      * - dpl = 0, unless syscall = 3 (Call from user)
      * - present = 1
      * - Offsets no change
+     * Both dwords are precomputed, so this is two stores per vector
      */
-    idt[i].seg_selector = KERNEL_CS;
-    idt[i].reserved4 = 0;
-    idt[i].reserved3 = ((i < TOTAL_EXC) || (i == VEC_SYSCALL));
-    idt[i].reserved2 = 1;
-    idt[i].reserved1 = 1;
-    idt[i].size = 1;
-    idt[i].dpl = (i == VEC_SYSCALL) ? 3 : 0;
-    idt[i].present = 1;
-    SET_IDT_ENTRY(idt[i], default_interrupt);
+    idt[i].val[0] = low;
+    idt[i].val[1] = high | ((i < TOTAL_EXC) ? IDT_GATE_TRAP : IDT_GATE_INTERRUPT);
   }
+  idt[VEC_SYSCALL].val[1] = high | IDT_GATE_TRAP | IDT_GATE_DPL_USER;
   // Set IDT for Handlers
   SET_IDT_ENTRY(idt[VEC_SYSCALL], handle_syscall);
-  SET_IDT_ENTRY(idt[VEC_TIMER], timer_isr);
-  SET_IDT_ENTRY(idt[VEC_KEYBOARD], keyboard_isr);
-  SET_IDT_ENTRY(idt[VEC_RTC], rtc_isr);
+  // Every ISA line, drivers attach to them with request_irq
+  for (i = 0; i < IRQ_NUM_LINES; i++)
+    SET_IDT_ENTRY(idt[VEC_IRQ_BASE + i], irq_stubs[i]);
+  SET_IDT_ENTRY(idt[VEC_SPURIOUS], spurious_isr);
+  SET_IDT_ENTRY(idt[VEC_SMP_KICK], smp_kick_isr);
+  SET_IDT_ENTRY(idt[VEC_SMP_TICK], smp_tick_isr);
   // Set IDT for Exception Handlers
   // No handler for reserved exc.
   SET_IDT_ENTRY(idt[EXC_DIVIDE], HANDLE_EXC_FUNCTION_NAME(EXC_DIVIDE));
@@ -92,4 +102,16 @@ void init_idt() {
   lidt(idt_desc_ptr);
 }
 
+/**
+ * Initializes the IDT Table at boot.
+ *
+ * INPUT: none
+ * OUTPUT: none
+ * SIDE EFFECT: Populates the IDT Table and records the "idt" boot phase.
+ */
+void init_idt() {
+  build_idt();
+  boot_phase("idt");
+}
+
 // END CP1.3
@@ -4,5 +4,8 @@
 
 #pragma once
 
-// Function that sets up the IDT
+// Function that sets up the IDT, once at boot
 extern void init_idt(void);
+
+// Same without recording a boot phase
+extern void build_idt(void);
@@ -11,9 +11,14 @@
  */
 
 #define VEC_SYSCALL 0x80
+#define VEC_IRQ_BASE 0x20  // IRQ n arrives on VEC_IRQ_BASE + n
 #define VEC_TIMER 0x20
 #define VEC_KEYBOARD 0x21
+#define VEC_SERIAL 0x24
 #define VEC_RTC 0x28
+#define VEC_SMP_KICK 0xF0  // IPI that wakes a CPU to look at its run queue
+#define VEC_SMP_TICK 0xF1  // LAPIC timer of an AP, its scheduler tick
+#define VEC_SPURIOUS 0xFF  // LAPIC spurious interrupts, no EOI
 
 // Ignoring 1, 9, 15, which are Intel reserved.
 #define EXC_DIVIDE 0
@@ -0,0 +1,73 @@
+/**
+ * Kernel workqueue.
+ * A single FIFO of work items on the BSP, which is where device interrupts
+ * are delivered. An item sits in the queue at most once; queueing it again
+ * before it started is a no-op, so a burst of interrupts costs one run.
+ */
+#include "workqueue.h"
+#include "../lib.h"
+#include "../tsc.h"
+#include "../irqoff.h"
+
+#define WORK_QUEUE_MASK (WORK_QUEUE_SIZE - 1)
+
+static work_t *work_ring[WORK_QUEUE_SIZE];
+static uint32_t work_head, work_tail;  /* Free running */
+static volatile uint8_t work_running;
+
+/**
+ * Queues a work item.
+ * INPUT: work: Item to run
+ * OUTPUT: 0 if queued, 1 if already pending, -1 if the queue is full
+ */
+int32_t work_queue(work_t *work) {
+    uint32_t flags;
+    int32_t result = 0;
+    irqoff_save(flags);
+    if (work->pending) {
+        result = 1;
+    } else if (work_head - work_tail == WORK_QUEUE_SIZE) {
+        result = -1;
+    } else {
+        work->pending = 1;
+        work_ring[work_head++ & WORK_QUEUE_MASK] = work;
+    }
+    irqoff_restore(flags);
+    return result;
+}
+
+/**
+ * Drains the queue.
+ * INPUT: None
+ * OUTPUT: Number of items run
+ * EFFECT: Must be called with interrupts off. Each item runs with them on,
+ *         so its top half can interrupt it and queue more work, which this
+ *         same loop picks up. Does nothing if a bottom half is already
+ *         running further down the stack.
+ */
+uint32_t work_run_pending() {
+    work_t *work;
+    uint64_t start;
+    uint32_t cycles, count = 0;
+    if (work_running) return 0;
+    work_running = 1;
+    while (work_tail != work_head) {
+        work = work_ring[work_tail++ & WORK_QUEUE_MASK];
+        // Cleared first, so the item can be queued again while it runs
+        work->pending = 0;
+        irqoff_sti();
+        start = rdtsc();
+        work->fn(work->arg);
+        cycles = (uint32_t)(rdtsc() - start);
+        irqoff_cli();
+        work->runs++;
+        if (cycles > work->max_cycles) work->max_cycles = cycles;
+        count++;
+    }
+    work_running = 0;
+    return count;
+}
+
+int32_t work_in_progress() {
+    return work_running;
+}
@@ -0,0 +1,36 @@
+/**
+ * Kernel workqueue for interrupt bottom halves.
+ * Top halves run with interrupts off and only do what can't wait: ack the
+ * device, grab its data, queue a work item. The queued work then runs with
+ * interrupts on, from irq_exit, before the interrupted code resumes.
+ */
+#pragma once
+
+#include "../types.h"
+
+#define WORK_QUEUE_SIZE 16  /* Power of two */
+
+typedef void (*work_fn_t)(void *arg);
+
+typedef struct {
+  const int8_t *name;
+  work_fn_t fn;
+  void *arg;
+  volatile uint8_t pending;  /* Queued and not started yet */
+  uint32_t runs;
+  uint32_t max_cycles;  /* Longest run, interrupts on */
+} work_t;
+
+#define WORK_INIT(name, fn, arg) {name, fn, arg, 0, 0, 0}
+
+/* Queues work to run before the interrupted code resumes. Callable with
+ * interrupts off. Returns 0, 1 if it was pending already (one run covers
+ * both), -1 if the queue is full. */
+int32_t work_queue(work_t *work);
+
+/* Runs queued work in FIFO order with interrupts on. Called and returns
+ * with interrupts off. Returns the number of items run. */
+uint32_t work_run_pending(void);
+
+/* 1 while work_run_pending is running work, i.e. in a bottom half */
+int32_t work_in_progress(void);
@@ -0,0 +1,120 @@
+#include "irqoff.h"
+#include "smp.h"
+#include "tsc.h"
+#include "apic.h"
+#include "interrupt/vectors.h"
+
+#define IRQOFF_NAME_WIDTH 24
+
+/* What is open on each CPU: since when and who turned interrupts off */
+static struct {
+    uint64_t since;
+    irqoff_site_t* site;
+} irqoff_open[SMP_MAX_CPUS];
+
+static irqoff_site_t* sites[IRQOFF_MAX_SITES];
+static uint32_t num_sites;
+static spinlock_t sites_lock = SPINLOCK_INIT;
+
+/* One site per ISA IRQ line, opened by the stub before the handler runs */
+static irqoff_site_t irq_sites[APIC_NUM_ISA_IRQS];
+
+void irqoff_begin(irqoff_site_t* site) {
+    uint32_t cpu;
+    if (!IRQOFF_TRACE) return;
+    cpu = smp_this_cpu()->index;
+    if (irqoff_open[cpu].site) return;
+    irqoff_open[cpu].site = site;
+    irqoff_open[cpu].since = rdtsc();
+}
+
+void irqoff_end() {
+    uint32_t cpu = smp_this_cpu()->index;
+    irqoff_site_t* site = irqoff_open[cpu].site;
+    uint32_t cycles, bucket;
+    if (!site) return;
+    cycles = (uint32_t)(rdtsc() - irqoff_open[cpu].since);
+    irqoff_open[cpu].site = NULL;
+    for (bucket = 0; bucket < IRQOFF_BUCKETS - 1; bucket++)
+        if (cycles < (1U << (bucket + IRQOFF_BUCKET_SHIFT))) break;
+    spin_lock(&sites_lock);
+    // Sites register the first time a stretch of theirs ends
+    if (!site->registered && num_sites < IRQOFF_MAX_SITES) {
+        site->registered = 1;
+        sites[num_sites++] = site;
+    }
+    site->count++;
+    site->hist[bucket]++;
+    if (cycles > site->max_cycles) site->max_cycles = cycles;
+    spin_unlock(&sites_lock);
+}
+
+void irqoff_irq_enter(uint32_t vector) {
+    irqoff_site_t* site = &irq_sites[(vector - VEC_IRQ_BASE) % APIC_NUM_ISA_IRQS];
+    if (!site->func) {
+        site->func = "irq";
+        site->line = vector - VEC_IRQ_BASE;
+    }
+    irqoff_begin(site);
+}
+
+void irqoff_iret(uint32_t eflags) {
+    if (eflags & IRQOFF_EFLAGS_IF) irqoff_end();
+}
+
+void irqoff_reset() {
+    uint32_t i, bucket, flags;
+    // Plain cli: irqoff_end takes the lock from interrupt context
+    cli_and_save(flags);
+    spin_lock(&sites_lock);
+    for (i = 0; i < num_sites; i++) {
+        sites[i]->count = 0;
+        sites[i]->max_cycles = 0;
+        for (bucket = 0; bucket < IRQOFF_BUCKETS; bucket++)
+            sites[i]->hist[bucket] = 0;
+    }
+    spin_unlock(&sites_lock);
+    restore_flags(flags);
+}
+
+/* proc/irqoff: one row per site, worst first. Sites are function:line,
+ * hardware interrupts irq:line number from entry until the bottom halves
+ * or iret turn interrupts back on. */
+void irqoff_info(procfs_out_t* out) {
+    irqoff_site_t* sorted[IRQOFF_MAX_SITES];
+    irqoff_site_t* key;
+    uint32_t i, j, n, bucket, len, flags;
+    int8_t number[11];
+    cli_and_save(flags);
+    spin_lock(&sites_lock);
+    n = num_sites;
+    for (i = 0; i < n; i++) {
+        key = sites[i];
+        for (j = i; j > 0 && sorted[j - 1]->max_cycles < key->max_cycles; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = key;
+    }
+    spin_unlock(&sites_lock);
+    restore_flags(flags);
+
+    procfs_puts(out, "site                       count       max");
+    for (bucket = 0; bucket < IRQOFF_BUCKETS - 1; bucket++) {
+        procfs_puts(out, " <");
+        procfs_putu(out, 1U << (bucket + IRQOFF_BUCKET_SHIFT - 10), 3);
+        procfs_puts(out, "k");
+    }
+    procfs_puts(out, "  more\n");
+    for (i = 0; i < n; i++) {
+        itoa(sorted[i]->line, number, 10);
+        len = strlen((int8_t*)sorted[i]->func) + 1 + strlen(number);
+        procfs_puts(out, (const int8_t*)sorted[i]->func);
+        procfs_puts(out, ":");
+        procfs_puts(out, number);
+        for (; len < IRQOFF_NAME_WIDTH; len++) procfs_puts(out, " ");
+        procfs_putu(out, sorted[i]->count, 8);
+        procfs_putu(out, sorted[i]->max_cycles, 10);
+        for (bucket = 0; bucket < IRQOFF_BUCKETS; bucket++)
+            procfs_putu(out, sorted[i]->hist[bucket], 6);
+        procfs_puts(out, "\n");
+    }
+}
@@ -0,0 +1,101 @@
+/* irqoff.h - How long interrupts stay off, per call site
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _IRQOFF_H
+#define _IRQOFF_H
+
+#include "types.h"
+
+/* Off by default, the probes cost two rdtsc per stretch. Build with
+ * -DIRQOFF_TRACE=1 to fill in proc/irqoff. */
+#ifndef IRQOFF_TRACE
+#define IRQOFF_TRACE 0
+#endif
+
+#define IRQOFF_MAX_SITES 96
+/* Histogram bucket n counts stretches under 2^(n + 11) cycles, the last
+ * one everything longer */
+#define IRQOFF_BUCKETS 10
+#define IRQOFF_BUCKET_SHIFT 11
+#define IRQOFF_EFLAGS_IF 0x200
+
+#ifndef ASM
+
+#include "lib.h"
+#include "driver/procfs.h"
+
+typedef struct {
+    const char* func;
+    uint32_t line;
+    uint8_t registered;
+    uint32_t count;
+    uint32_t max_cycles;
+    uint32_t hist[IRQOFF_BUCKETS];
+} irqoff_site_t;
+
+/* Interrupts just went off at site. Only the outermost stretch is timed,
+ * so this does nothing while one is already open on this CPU, or when
+ * built with IRQOFF_TRACE=0. */
+void irqoff_begin(irqoff_site_t* site);
+
+/* Interrupts are about to go back on: charges the open stretch, if any,
+ * to the site that opened it */
+void irqoff_end(void);
+
+/* Hardware interrupt entry, from the IRQ stubs in isr.S */
+void irqoff_irq_enter(uint32_t vector);
+
+/* From interrupt_return: closes the stretch if iret turns interrupts on */
+void irqoff_iret(uint32_t eflags);
+
+/* Forgets everything measured so far */
+void irqoff_reset(void);
+
+/* proc/irqoff */
+void irqoff_info(procfs_out_t* out);
+
+#define IRQOFF_SITE(site) \
+    static irqoff_site_t site = {__FUNCTION__, __LINE__}
+
+#if IRQOFF_TRACE
+
+/* Drop-in replacements for cli/sti/cli_and_save/restore_flags */
+#define irqoff_cli()                                                           \
+    do {                                                                       \
+        IRQOFF_SITE(irqoff_here);                                              \
+        cli();                                                                 \
+        irqoff_begin(&irqoff_here);                                            \
+    } while (0)
+
+#define irqoff_sti()                                                           \
+    do {                                                                       \
+        irqoff_end();                                                          \
+        sti();                                                                 \
+    } while (0)
+
+#define irqoff_save(flags)                                                     \
+    do {                                                                       \
+        IRQOFF_SITE(irqoff_here);                                              \
+        cli_and_save(flags);                                                   \
+        if ((flags) & IRQOFF_EFLAGS_IF) irqoff_begin(&irqoff_here);            \
+    } while (0)
+
+#define irqoff_restore(flags)                                                  \
+    do {                                                                       \
+        if ((flags) & IRQOFF_EFLAGS_IF) irqoff_end();                          \
+        restore_flags(flags);                                                  \
+    } while (0)
+
+#else
+
+#define irqoff_cli() cli()
+#define irqoff_sti() sti()
+#define irqoff_save(flags) cli_and_save(flags)
+#define irqoff_restore(flags) restore_flags(flags)
+
+#endif /* IRQOFF_TRACE */
+
+#endif /* ASM */
+
+#endif /* _IRQOFF_H */
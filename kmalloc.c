@@ -0,0 +1,332 @@
+#include "kmalloc.h"
+#include "lib.h"
+#include "irqoff.h"
+
+/* Backing store for the heap. Pages are handed out bump-style the first
+ * time, after that they are recycled through a free list threaded through
+ * their first word. */
+static uint8_t kheap_pool[KHEAP_NUM_PAGES][KHEAP_PAGE_SIZE]
+    __attribute__((aligned(KHEAP_PAGE_SIZE)));
+static void* kheap_free_pages = NULL;
+static uint32_t kheap_next_page = 0;
+static uint32_t kheap_in_use = 0;
+
+static kmem_cache_t caches[KMEM_NUM_CACHES];
+static uint32_t num_caches = 0;
+
+/* kmalloc size classes, created on the first kmalloc() */
+static kmem_cache_t* kmalloc_caches[KMALLOC_NUM_CLASSES];
+static const int8_t* kmalloc_names[KMALLOC_NUM_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+
+/**
+ * Takes a page from the heap pool.
+ * INPUT: None
+ * OUTPUT: Page aligned 4kB block, NULL when the pool is exhausted
+ */
+void* kheap_page_alloc() {
+    void* page = NULL;
+    uint32_t flags;
+    irqoff_save(flags);
+    if (kheap_free_pages) {
+        page = kheap_free_pages;
+        kheap_free_pages = *(void**)page;
+    } else if (kheap_next_page < KHEAP_NUM_PAGES) {
+        page = kheap_pool[kheap_next_page++];
+    }
+    if (page) kheap_in_use++;
+    irqoff_restore(flags);
+    return page;
+}
+
+/**
+ * Returns a page to the heap pool.
+ * INPUT: page: Page from kheap_page_alloc
+ * OUTPUT: None
+ */
+void kheap_page_free(void* page) {
+    uint32_t flags;
+    irqoff_save(flags);
+    *(void**)page = kheap_free_pages;
+    kheap_free_pages = page;
+    kheap_in_use--;
+    irqoff_restore(flags);
+}
+
+uint32_t kheap_pages_used() {
+    return kheap_in_use;
+}
+
+/* Slab list helpers, the lists are doubly linked through the headers */
+static void slab_push(kmem_slab_t** list, kmem_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_unlink(kmem_slab_t** list, kmem_slab_t* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static int32_t cache_poisons(kmem_cache_t* cache) {
+    return (cache->flags & KMEM_POISON) && !cache->ctor;
+}
+
+/* Poison everything but the free list link */
+static void object_poison(kmem_cache_t* cache, void* object) {
+    memset((uint8_t*)object + sizeof(void*), KMEM_POISON_BYTE,
+           cache->object_size - sizeof(void*));
+}
+
+/* Returns 1 if nobody wrote to the object since it was poisoned */
+static int32_t object_poison_intact(kmem_cache_t* cache, void* object) {
+    uint8_t* byte = (uint8_t*)object + sizeof(void*);
+    uint8_t* end = (uint8_t*)object + cache->object_size;
+    for (; byte < end; byte++)
+        if (*byte != KMEM_POISON_BYTE) return 0;
+    return 1;
+}
+
+/* Carves a fresh page into objects and puts it on the empty list */
+static kmem_slab_t* slab_grow(kmem_cache_t* cache) {
+    kmem_slab_t* slab = kheap_page_alloc();
+    uint8_t* object;
+    uint32_t i;
+    if (!slab) return NULL;
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+    // Build the free list backwards so objects go out in address order
+    for (i = cache->objects_per_slab; i-- > 0;) {
+        object = (uint8_t*)slab + KMEM_SLAB_HEADER + i * cache->object_size;
+        if (cache->ctor) cache->ctor(object);
+        else if (cache_poisons(cache)) object_poison(cache, object);
+        *(void**)object = slab->free_list;
+        slab->free_list = object;
+    }
+    slab_push(&cache->empty, slab);
+    cache->num_slabs++;
+    return slab;
+}
+
+/**
+ * Creates an object cache.
+ * INPUT: name: Shown in proc/slabinfo
+ *        size: Object size in bytes
+ *        ctor: Optional constructor, run once per object
+ *        flags: KMEM_POISON or 0
+ * OUTPUT: The cache, NULL if size is too big or no cache is left
+ */
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size,
+                                void (*ctor)(void*), uint32_t flags) {
+    kmem_cache_t* cache;
+    uint32_t saved;
+    if (size < KMEM_MIN_OBJECT) size = KMEM_MIN_OBJECT;
+    size = (size + 3) & ~3;  // Keep the links aligned
+    if (size > KHEAP_PAGE_SIZE - KMEM_SLAB_HEADER) return NULL;
+    irqoff_save(saved);
+    if (num_caches >= KMEM_NUM_CACHES) {
+        irqoff_restore(saved);
+        return NULL;
+    }
+    cache = &caches[num_caches++];
+    irqoff_restore(saved);
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy(cache->name, name, KMEM_NAME_LENGTH - 1);
+    cache->name[KMEM_NAME_LENGTH - 1] = 0;
+    cache->object_size = size;
+    cache->objects_per_slab = (KHEAP_PAGE_SIZE - KMEM_SLAB_HEADER) / size;
+    cache->flags = flags;
+    cache->ctor = ctor;
+    return cache;
+}
+
+/**
+ * Allocates an object.
+ * INPUT: cache: Cache to take it from
+ * OUTPUT: The object, NULL when out of memory. Objects of a cache with a
+ *         constructor come back constructed, others hold garbage.
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    kmem_slab_t* slab;
+    void* object;
+    uint32_t flags;
+    irqoff_save(flags);
+    // Prefer partial slabs so empty ones can be given back
+    slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty ? cache->empty : slab_grow(cache);
+        if (!slab) {
+            irqoff_restore(flags);
+            return NULL;
+        }
+        slab_unlink(&cache->empty, slab);
+        slab_push(&cache->partial, slab);
+    }
+    object = slab->free_list;
+    slab->free_list = *(void**)object;
+    if (++slab->in_use == cache->objects_per_slab) {
+        slab_unlink(&cache->partial, slab);
+        slab_push(&cache->full, slab);
+    }
+    cache->active_objects++;
+    cache->allocs++;
+    if (cache_poisons(cache) && !object_poison_intact(cache, object)) {
+        cache->poison_errors++;
+        printf("kmem: %s object %x written after free\n", cache->name, object);
+    }
+    irqoff_restore(flags);
+    return object;
+}
+
+/**
+ * Frees an object.
+ * INPUT: cache: Cache it came from
+ *        object: The object
+ * OUTPUT: None
+ * EFFECT: A slab that becomes empty is kept around if it's the only empty
+ *         one, otherwise its page goes back to the pool.
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+    kmem_slab_t* slab = (kmem_slab_t*)((uint32_t)object & ~(KHEAP_PAGE_SIZE - 1));
+    void* free_object;
+    uint32_t flags;
+    irqoff_save(flags);
+    if (cache_poisons(cache)) {
+        // Double frees show up as the object already being on the list
+        for (free_object = slab->free_list; free_object;
+             free_object = *(void**)free_object) {
+            if (free_object == object) {
+                cache->poison_errors++;
+                printf("kmem: %s object %x freed twice\n", cache->name, object);
+                irqoff_restore(flags);
+                return;
+            }
+        }
+        object_poison(cache, object);
+    }
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_unlink(&cache->full, slab);
+        slab_push(&cache->partial, slab);
+    }
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    cache->active_objects--;
+    cache->frees++;
+    if (!--slab->in_use) {
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty) {
+            cache->num_slabs--;
+            kheap_page_free(slab);
+        } else {
+            slab_push(&cache->empty, slab);
+        }
+    }
+    irqoff_restore(flags);
+}
+
+/**
+ * Releases the empty slabs of a cache.
+ * INPUT: cache: The cache
+ * OUTPUT: None
+ */
+void kmem_cache_shrink(kmem_cache_t* cache) {
+    kmem_slab_t* slab;
+    uint32_t flags;
+    irqoff_save(flags);
+    while ((slab = cache->empty)) {
+        slab_unlink(&cache->empty, slab);
+        cache->num_slabs--;
+        kheap_page_free(slab);
+    }
+    irqoff_restore(flags);
+}
+
+/**
+ * General purpose allocation from the size class caches.
+ * INPUT: size: Bytes needed, at most KMALLOC_MAX_SIZE
+ * OUTPUT: The block, NULL if too big or out of memory
+ */
+void* kmalloc(uint32_t size) {
+    uint32_t class = 0, flags;
+    if (!size || size > KMALLOC_MAX_SIZE) return NULL;
+    while ((1U << (KMALLOC_MIN_SHIFT + class)) < size) class++;
+    if (!kmalloc_caches[class]) {
+        irqoff_save(flags);
+        if (!kmalloc_caches[class])
+            kmalloc_caches[class] = kmem_cache_create(kmalloc_names[class],
+                1 << (KMALLOC_MIN_SHIFT + class), NULL,
+                KMALLOC_DEBUG ? KMEM_POISON : 0);
+        irqoff_restore(flags);
+        if (!kmalloc_caches[class]) return NULL;
+    }
+    return kmem_cache_alloc(kmalloc_caches[class]);
+}
+
+/**
+ * Frees a kmalloc block. The owning cache is found from the slab header.
+ * INPUT: ptr: Block from kmalloc, NULL is ignored
+ * OUTPUT: None
+ */
+void kfree(void* ptr) {
+    kmem_slab_t* slab;
+    kmem_cache_t* cache;
+    uint32_t offset;
+    if (!ptr) return;
+    if ((uint8_t*)ptr < kheap_pool[0] ||
+        (uint8_t*)ptr >= kheap_pool[KHEAP_NUM_PAGES]) {
+        printf("kfree: %x is not a heap pointer\n", ptr);
+        return;
+    }
+    slab = (kmem_slab_t*)((uint32_t)ptr & ~(KHEAP_PAGE_SIZE - 1));
+    if ((uint8_t*)ptr < (uint8_t*)slab + KMEM_SLAB_HEADER) {
+        printf("kfree: %x is not an object\n", ptr);
+        return;
+    }
+    offset = (uint32_t)ptr - (uint32_t)slab - KMEM_SLAB_HEADER;
+    // A released page holds the pool's free list link in this word, so the
+    // pointer has to be one of the caches before it is followed
+    cache = slab->cache;
+    if (cache < caches || cache >= caches + num_caches ||
+        offset % cache->object_size ||
+        offset / cache->object_size >= cache->objects_per_slab) {
+        printf("kfree: %x is not an object\n", ptr);
+        return;
+    }
+    kmem_cache_free(cache, ptr);
+}
+
+/**
+ * Renders the cache stats.
+ * INPUT: out: Output being rendered
+ * OUTPUT: None
+ */
+void kmem_slabinfo(procfs_out_t* out) {
+    uint32_t i;
+    kmem_cache_t* cache;
+    procfs_puts(out, "heap pages ");
+    procfs_putu(out, kheap_pages_used(), 0);
+    procfs_puts(out, " of ");
+    procfs_putu(out, KHEAP_NUM_PAGES, 0);
+    procfs_puts(out, "\nNAME             SIZE PER SLAB SLABS  ACTIVE"
+                     "   TOTAL  ALLOCS   FREES POISON\n");
+    for (i = 0; i < num_caches; i++) {
+        cache = &caches[i];
+        procfs_puts(out, cache->name);
+        procfs_putu(out, cache->object_size,
+                    KMEM_NAME_LENGTH + 5 - strlen(cache->name));
+        procfs_putu(out, cache->objects_per_slab, 9);
+        procfs_putu(out, cache->num_slabs, 6);
+        procfs_putu(out, cache->active_objects, 8);
+        procfs_putu(out, cache->num_slabs * cache->objects_per_slab, 8);
+        procfs_putu(out, cache->allocs, 8);
+        procfs_putu(out, cache->frees, 8);
+        procfs_putu(out, cache->poison_errors, 7);
+        procfs_puts(out, "\n");
+    }
+}
@@ -0,0 +1,91 @@
+/* kmalloc.h - Kernel heap: slab caches and kmalloc
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _KMALLOC_H
+#define _KMALLOC_H
+
+#include "types.h"
+#include "driver/procfs.h"
+
+#define KHEAP_PAGE_SIZE 0x1000
+#define KHEAP_NUM_PAGES 128  /* 512kB, carved out of the kernel's 4MB page */
+
+#define KMEM_NUM_CACHES 16
+#define KMEM_NAME_LENGTH 16
+#define KMEM_SLAB_HEADER 32  /* kmem_slab_t at the start of each page */
+#define KMEM_MIN_OBJECT 8  /* Free objects hold the free list link */
+
+/* Cache flags */
+#define KMEM_POISON 0x1  /* Poison freed objects, check them on reuse */
+
+#define KMEM_POISON_BYTE 0x6B
+
+/* Set to 1 to poison the kmalloc size classes too. Off by default, it
+ * costs a memset on every kfree and a scan on every kmalloc. */
+#define KMALLOC_DEBUG 0
+
+/* kmalloc size classes: 16 bytes up to 1kB in powers of two. A 2kB class
+ * would only fit one object next to the slab header. */
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_NUM_CLASSES 7
+#define KMALLOC_MAX_SIZE (1 << (KMALLOC_MIN_SHIFT + KMALLOC_NUM_CLASSES - 1))
+
+#ifndef ASM
+
+struct kmem_cache;
+
+/* One page worth of objects, header at the start of the page */
+typedef struct kmem_slab {
+    struct kmem_cache* cache;
+    struct kmem_slab* prev;
+    struct kmem_slab* next;
+    void* free_list;
+    uint32_t in_use;  /* Allocated objects */
+} kmem_slab_t;
+
+typedef struct kmem_cache {
+    int8_t name[KMEM_NAME_LENGTH];
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    uint32_t flags;
+    void (*ctor)(void* object);
+    /* Every slab sits on exactly one of these */
+    kmem_slab_t* partial;
+    kmem_slab_t* full;
+    kmem_slab_t* empty;
+    /* Stats, shown in proc/slabinfo */
+    uint32_t num_slabs;
+    uint32_t active_objects;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t poison_errors;
+} kmem_cache_t;
+
+/* Creates a cache of fixed size objects. ctor runs once per object when a
+ * slab is populated; objects are expected to be freed back in their
+ * constructed state, so reuse skips it. Poisoning is ignored for caches
+ * with a constructor since it would destroy that state.
+ * Returns NULL if the size doesn't fit a slab or all caches are taken. */
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size,
+                                void (*ctor)(void*), uint32_t flags);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+/* Gives every completely empty slab back to the page pool */
+void kmem_cache_shrink(kmem_cache_t* cache);
+
+/* General purpose allocation, up to KMALLOC_MAX_SIZE bytes */
+void* kmalloc(uint32_t size);
+void kfree(void* ptr);
+
+/* Pages backing the slabs */
+void* kheap_page_alloc(void);
+void kheap_page_free(void* page);
+uint32_t kheap_pages_used(void);
+
+/* proc/slabinfo generator */
+void kmem_slabinfo(procfs_out_t* out);
+
+#endif /* ASM */
+
+#endif /* _KMALLOC_H */
@@ -0,0 +1,223 @@
+#include "shm.h"
+#include "lib.h"
+#include "paging.h"
+#include "buddy.h"
+#include "interrupt/process.h"
+#include "driver/terminal.h"
+#include "irqoff.h"
+#include "smp.h"
+#include "interrupt/sched.h"
+
+#define SHM_PAGE_FLAGS 0x7  /* Present, R/W, User */
+#define SHM_NOT_LOADED 0xFFFFFFFF
+
+/* Page table for the whole shm window, one per CPU since each runs its
+ * own process. Slots are fixed: segment n always owns entries
+ * n*SHM_MAX_PAGES to (n+1)*SHM_MAX_PAGES-1. */
+static uint32_t pgTblShm[SMP_MAX_CPUS][1024] __attribute__((aligned(4096)));
+static shm_segment_t segments[NUM_SHM_SEGMENTS];
+
+/* Attach mask currently loaded into each pgTblShm, lets shm_switch skip
+ * the rewrite when two processes share the same set of segments (usually
+ * none at all). */
+static uint32_t loaded_mask[SMP_MAX_CPUS] = {[0 ... SMP_MAX_CPUS - 1] = SHM_NOT_LOADED};
+
+/* Makes every CPU rewrite its table on its next shm_switch */
+static void shm_invalidate() {
+    uint32_t cpu;
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) loaded_mask[cpu] = SHM_NOT_LOADED;
+}
+
+/* Physical address of a page of a segment */
+static uint32_t shm_phys_page(int32_t shmid, uint32_t page) {
+    return segments[shmid].phys + page * SHM_PAGE_SIZE;
+}
+
+/* Returns the PCB of the process making the syscall */
+static pcb_t* shm_current_pcb() {
+    return processes[terminals[active_terminal].pid];
+}
+
+/**
+ * Loads the segment mappings of a process.
+ * INPUT: pid: Process that is about to run, 0 for none
+ * OUTPUT: None
+ * EFFECT: Rewrites the shm page table and its directory entry, then
+ *         flushes the non-global TLB entries. Nothing happens when the
+ *         process has the same segments as the last one.
+ */
+void shm_switch(uint8_t pid) {
+    int32_t shmid;
+    uint32_t page;
+    uint32_t mask = pid ? processes[pid]->shm_attached : 0;
+    cpu_t* cpu = smp_this_cpu();
+    uint32_t* table = pgTblShm[cpu->index];
+    if (mask == loaded_mask[cpu->index]) return;
+    for (shmid = 0; shmid < NUM_SHM_SEGMENTS; shmid++) {
+        for (page = 0; page < SHM_MAX_PAGES; page++) {
+            if ((mask & (1 << shmid)) && page < segments[shmid].num_pages)
+                table[shmid * SHM_MAX_PAGES + page] =
+                    shm_phys_page(shmid, page) | SHM_PAGE_FLAGS;
+            else
+                table[shmid * SHM_MAX_PAGES + page] = 0;
+        }
+    }
+    cpu->pgdir[SHM_PDE_INDEX] = mask ? ((uint32_t)table | SHM_PAGE_FLAGS) : 0;
+    loaded_mask[cpu->index] = mask;
+    flush_tlb();  // Kernel pages are global, only user entries go
+}
+
+/**
+ * Finds or creates a shared segment.
+ * INPUT: key: Name processes agree on to find the same segment
+ *        size: Bytes needed, up to SHM_MAX_SIZE
+ * OUTPUT: Segment id, -1 if the size is bad or no segment is left
+ */
+int32_t shmget(int32_t key, uint32_t size) {
+    int32_t shmid;
+    uint32_t num_pages = (size + SHM_PAGE_SIZE - 1) / SHM_PAGE_SIZE;
+    uint32_t phys;
+    if (!size || size > SHM_MAX_SIZE) return -1;
+    irqoff_cli();
+    // STEP 1: Someone already made it?
+    for (shmid = 0; shmid < NUM_SHM_SEGMENTS; shmid++) {
+        if (segments[shmid].in_use && segments[shmid].key == key) {
+            irqoff_sti();
+            return (num_pages <= segments[shmid].num_pages) ? shmid : -1;
+        }
+    }
+    // STEP 2: Make a new one
+    for (shmid = 0; shmid < NUM_SHM_SEGMENTS; shmid++) {
+        if (!segments[shmid].in_use) {
+            phys = frame_alloc(frame_order(num_pages));
+            if (!phys) break;
+            segments[shmid].phys = phys;
+            segments[shmid].order = frame_order(num_pages);
+            segments[shmid].in_use = 1;
+            segments[shmid].fresh = 1;
+            segments[shmid].zeroing = 0;
+            segments[shmid].attached = 0;
+            segments[shmid].num_pages = num_pages;
+            segments[shmid].key = key;
+            segments[shmid].owner = terminals[active_terminal].pid;
+            irqoff_sti();
+            return shmid;
+        }
+    }
+    irqoff_sti();
+    return -1;
+}
+
+/**
+ * Maps a segment into the calling process.
+ * INPUT: shmid: Segment from shmget
+ * OUTPUT: User address of the segment, -1 on a bad id
+ * EFFECT: The segment is zeroed the first time anybody attaches it.
+ *         That runs with interrupts on, since it can be 64kB; whoever
+ *         attaches in the meantime sleeps until it's done.
+ */
+int32_t shmat(int32_t shmid) {
+    pcb_t* pcb = shm_current_pcb();
+    uint8_t zero;
+    if (shmid < 0 || shmid >= NUM_SHM_SEGMENTS) return -1;
+    irqoff_cli();
+    if (!segments[shmid].in_use) {
+        irqoff_sti();
+        return -1;
+    }
+    // Attached before zeroing, so the segment can't go away under memset
+    if (!(pcb->shm_attached & (1 << shmid))) {
+        pcb->shm_attached |= (1 << shmid);
+        segments[shmid].attached++;
+        shm_switch(pcb->pid);
+    }
+    zero = segments[shmid].fresh;
+    if (zero) {
+        segments[shmid].fresh = 0;
+        segments[shmid].zeroing = 1;
+    }
+    while (!zero && segments[shmid].zeroing)
+        sched_sleep_on(&segments[shmid]);
+    sched_wait_done();
+    irqoff_sti();
+    if (zero) {
+        memset((void*)SHM_SEGMENT_ADDR(shmid), 0,
+               segments[shmid].num_pages * SHM_PAGE_SIZE);
+        segments[shmid].zeroing = 0;
+        sched_wakeup(&segments[shmid]);
+    }
+    return SHM_SEGMENT_ADDR(shmid);
+}
+
+/* Gives a segment's frames back, the slot may come back with a new size */
+static void shm_free(int32_t shmid) {
+    segments[shmid].in_use = 0;
+    frame_free(segments[shmid].phys, segments[shmid].order);
+    shm_invalidate();
+}
+
+/* Drops one attachment without touching the page tables */
+static void shm_release(pcb_t* pcb, int32_t shmid) {
+    pcb->shm_attached &= ~(1 << shmid);
+    if (!--segments[shmid].attached) shm_free(shmid);
+}
+
+/**
+ * Unmaps a segment from the calling process.
+ * INPUT: shmid: Segment to detach
+ * OUTPUT: 0 on success, -1 if it wasn't attached
+ * EFFECT: Frees the segment when nobody has it attached anymore.
+ */
+int32_t shmdt(int32_t shmid) {
+    pcb_t* pcb = shm_current_pcb();
+    if (shmid < 0 || shmid >= NUM_SHM_SEGMENTS) return -1;
+    irqoff_cli();
+    if (!(pcb->shm_attached & (1 << shmid))) {
+        irqoff_sti();
+        return -1;
+    }
+    shm_release(pcb, shmid);
+    shm_invalidate();
+    shm_switch(pcb->pid);
+    irqoff_sti();
+    return 0;
+}
+
+/**
+ * Detaches everything a process still holds. Used by halt().
+ * INPUT: pid: The halting process
+ * OUTPUT: None
+ * EFFECT: Mappings are left for the next shm_switch() to clean up.
+ *         Segments it created that nobody ever attached are freed too,
+ *         the others lose their owner and go with their last detach.
+ */
+void shm_detach_all(uint8_t pid) {
+    int32_t shmid;
+    irqoff_cli();
+    for (shmid = 0; shmid < NUM_SHM_SEGMENTS; shmid++) {
+        if (processes[pid]->shm_attached & (1 << shmid))
+            shm_release(processes[pid], shmid);
+        if (!segments[shmid].in_use || segments[shmid].owner != pid) continue;
+        if (segments[shmid].attached)
+            segments[shmid].owner = 0;
+        else
+            shm_free(shmid);
+    }
+    shm_invalidate();
+    irqoff_sti();
+}
+
+/**
+ * Counts the shared pages a process has mapped.
+ * INPUT: pid: The process
+ * OUTPUT: Sum of the sizes of its attached segments, in pages
+ */
+uint32_t shm_attached_pages(uint8_t pid) {
+    int32_t shmid;
+    uint32_t pages = 0;
+    for (shmid = 0; shmid < NUM_SHM_SEGMENTS; shmid++) {
+        if (processes[pid]->shm_attached & (1 << shmid))
+            pages += segments[shmid].num_pages;
+    }
+    return pages;
+}
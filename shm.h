@@ -0,0 +1,52 @@
+/* shm.h - Shared memory segments mapped into several processes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+
+#define NUM_SHM_SEGMENTS 8
+#define SHM_PAGE_SIZE 0x1000
+#define SHM_MAX_PAGES 16  /* Largest segment: 64kB */
+#define SHM_MAX_SIZE (SHM_MAX_PAGES * SHM_PAGE_SIZE)
+
+/* Segments live in their own 4MB directory entry right after the vidmap
+ * page (140MB), so every process sees segment n at the same address. */
+#define SHM_PDE_INDEX 35
+#define SHM_VIRT_BASE (SHM_PDE_INDEX << 22)
+#define SHM_SEGMENT_ADDR(id) (SHM_VIRT_BASE + (id) * SHM_MAX_SIZE)
+
+#ifndef ASM
+
+typedef struct {
+    uint8_t in_use;
+    uint8_t fresh;      /* Not zeroed yet, done on the first attach */
+    uint8_t zeroing;    /* First attacher is clearing it, others wait */
+    uint8_t attached;   /* Number of processes that have it mapped */
+    uint8_t num_pages;
+    uint8_t order;      /* Frames come from the buddy allocator */
+    uint8_t owner;      /* Creator, frees it on halt if nobody attached it */
+    uint32_t phys;
+    int32_t key;
+} shm_segment_t;
+
+/* Syscalls. shmget fails when no physical frames are left either. */
+int32_t shmget(int32_t key, uint32_t size);
+int32_t shmat(int32_t shmid);
+int32_t shmdt(int32_t shmid);
+
+/* Load the segment mappings of a process into the shm page table.
+ * Flushes the TLB itself when anything changed. */
+void shm_switch(uint8_t pid);
+
+/* Drop every segment a halting process still has attached */
+void shm_detach_all(uint8_t pid);
+
+/* Number of 4kB pages a process has attached, for proc/top */
+uint32_t shm_attached_pages(uint8_t pid);
+
+#endif /* ASM */
+
+#endif /* _SHM_H */
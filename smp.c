@@ -0,0 +1,506 @@
+#include "smp.h"
+#include "apic.h"
+#include "lib.h"
+#include "tlb.h"
+#include "x86_desc.h"
+#include "driver/pit.h"
+#include "driver/terminal.h"
+#include "interrupt/vectors.h"
+#include "interrupt/sched.h"
+#include "interrupt/fpu.h"
+#include "interrupt/process.h"
+#include "interrupt/syscall.h"
+
+#define INIT_DELAY_US 10000
+#define STARTUP_DELAY_US 200
+#define ONLINE_TIMEOUT_US 10000
+#define ONLINE_POLL_US 100
+#define PTE_PRESENT_RW 0x3
+#define PTE_USER_RW 0x7
+#define PAGE_ENTRIES 1024
+#define TSS_AVAILABLE 0x9
+#define VIDMAP_ADDR (VIDMAP_PDE_INDEX << 22)
+
+extern uint32_t pgDir[];
+extern uint8_t ap_trampoline_start[], ap_trampoline_end[];
+extern uint8_t ap_tramp_gdt[], ap_tramp_cr3[], ap_tramp_cr4[], ap_tramp_esp[];
+
+/* The BSP's TSS and page directory are the ones the kernel set up */
+cpu_t cpus[SMP_MAX_CPUS] = {{.tss = &tss, .pgdir = pgDir, .scheduling = 1}};
+volatile uint32_t smp_num_cpus = 1;
+uint8_t smp_steal_enable = 1;
+spinlock_t kernel_lock = SPINLOCK_INIT;
+
+static uint8_t kernel_lock_on;  /* Set once a second CPU is up */
+static uint8_t kernel_lock_owner;  /* CPU that held it last */
+
+static uint8_t ap_stacks[SMP_MAX_CPUS][SMP_STACK_SIZE] __attribute__((aligned(16)));
+/* Each AP maps its own process at 128MB and its own terminal's video
+ * page, so it gets copies of the page directory and of the table under
+ * the low 4MB */
+static tss_t ap_tss[SMP_MAX_CPUS];
+static uint32_t ap_pgdir[SMP_MAX_CPUS][PAGE_ENTRIES] __attribute__((aligned(4096)));
+static uint32_t ap_low_table[SMP_MAX_CPUS][PAGE_ENTRIES] __attribute__((aligned(4096)));
+/* Every CPU's vidmap table, the BSP's included, see smp_vidmap */
+static uint32_t vidmap_table[SMP_MAX_CPUS][PAGE_ENTRIES] __attribute__((aligned(4096)));
+static uint8_t vidmap_used;  /* A process called vidmap */
+/* Owner of each terminal, see smp_terminal_cpu. All the BSP's until the
+ * APs are up. */
+static volatile uint8_t terminal_cpu[NUM_TERMINALS];
+static volatile uint32_t ap_booting;  /* Index handed to the next AP */
+
+/* Address of a trampoline data word once copied */
+#define TRAMP_FIELD(sym) \
+    ((void*)(AP_TRAMPOLINE + ((uint8_t*)(sym) - ap_trampoline_start)))
+
+static void runqueue_init(smp_runqueue_t* rq) {
+    rq->lock.locked = 0;
+    rq->head = rq->tail = 0;
+}
+
+/**
+ * CPU that runs a terminal's processes.
+ * INPUT: terminal: Terminal number
+ * OUTPUT: Index into cpus[]
+ * EFFECT: Spread round robin at boot, sched_balance moves them later.
+ */
+uint32_t smp_terminal_cpu(int32_t terminal) {
+    return terminal_cpu[terminal];
+}
+
+/**
+ * Hands a terminal, and with it all its processes, to another CPU.
+ * INPUT: terminal: Terminal number, not the caller's active one
+ *        cpu: Index into cpus[] of the new owner
+ * OUTPUT: None
+ * EFFECT: The new owner is woken up to look at it.
+ */
+void smp_set_terminal_cpu(int32_t terminal, uint32_t cpu) {
+    terminal_cpu[terminal] = cpu;
+    smp_kick(cpu);
+}
+
+/* Copies the trampoline under 1MB and fills in what every AP needs to
+ * reach ap_main: the GDT and the BSP's CR4 */
+static void trampoline_setup() {
+    uint32_t* low_table = (uint32_t*)(pgDir[0] & PAGE_FRAME_MASK);
+    low_table[AP_TRAMPOLINE >> 12] = AP_TRAMPOLINE | PTE_PRESENT_RW;
+    invlpg(AP_TRAMPOLINE);
+    memcpy((void*)AP_TRAMPOLINE, ap_trampoline_start,
+           ap_trampoline_end - ap_trampoline_start);
+    memcpy(TRAMP_FIELD(ap_tramp_gdt), &gdt_desc_ptr, 6);
+    *(uint32_t*)TRAMP_FIELD(ap_tramp_cr4) = read_cr4();
+}
+
+/* What an AP needs to run processes: a TSS with its GDT entry, and page
+ * tables of its own. No process ran yet, so the copies of the BSP's only
+ * hold kernel mappings (and the trampoline). */
+static void ap_setup(uint32_t index) {
+    cpu_t* cpu = &cpus[index];
+    seg_desc_t* desc = &ap_tss_desc_ptr[index - 1];
+    uint32_t* low_table = (uint32_t*)(pgDir[0] & PAGE_FRAME_MASK);
+    memcpy(ap_pgdir[index], pgDir, sizeof(ap_pgdir[index]));
+    memcpy(ap_low_table[index], low_table, sizeof(ap_low_table[index]));
+    ap_pgdir[index][0] = (uint32_t)ap_low_table[index] | (pgDir[0] & ~PAGE_FRAME_MASK);
+    // smp_vidmap fills in the AP's own, the BSP's table is never shared
+    ap_pgdir[index][VIDMAP_PDE_INDEX] = 0;
+    cpu->pgdir = ap_pgdir[index];
+
+    ap_tss[index].ldt_segment_selector = KERNEL_LDT;
+    ap_tss[index].ss0 = KERNEL_DS;
+    ap_tss[index].esp0 = (uint32_t)cpu->stack_top;
+    cpu->tss = &ap_tss[index];
+    desc->val[0] = desc->val[1] = 0;
+    desc->type = TSS_AVAILABLE;
+    desc->present = 1;
+    SET_TSS_PARAMS(ap_tss_desc_ptr[index - 1], &ap_tss[index], TSS_SIZE - 1);
+
+    cpu->terminal = cpu->prev_terminal = index % NUM_TERMINALS;
+    *(uint32_t*)TRAMP_FIELD(ap_tramp_cr3) = (uint32_t)ap_pgdir[index];
+}
+
+/* INIT, then the two startup IPIs the MP spec asks for, then wait for
+ * the AP to check in. Returns 1 if it did. */
+static int32_t smp_start_ap(uint8_t apic_id, uint32_t index) {
+    uint32_t waited;
+    cpu_t* cpu = &cpus[index];
+    cpu->index = index;
+    cpu->apic_id = apic_id;
+    cpu->online = 0;
+    cpu->stack_top = (uint32_t*)(ap_stacks[index] + SMP_STACK_SIZE);
+    runqueue_init(&cpu->runqueue);
+    ap_setup(index);
+    *(uint32_t*)TRAMP_FIELD(ap_tramp_esp) = (uint32_t)cpu->stack_top;
+    ap_booting = index;
+
+    lapic_send_ipi(apic_id, ICR_INIT);
+    pit_delay_us(INIT_DELAY_US);
+    lapic_send_ipi(apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+    pit_delay_us(STARTUP_DELAY_US);
+    if (!cpu->online)
+        lapic_send_ipi(apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+    for (waited = 0; !cpu->online && waited < ONLINE_TIMEOUT_US;
+         waited += ONLINE_POLL_US)
+        pit_delay_us(ONLINE_POLL_US);
+    return cpu->online;
+}
+
+/**
+ * Brings up the application processors.
+ * INPUT: None
+ * OUTPUT: Number of CPUs online, the BSP included
+ * EFFECT: There is no MADT parsing, so LAPIC IDs are assumed to be
+ *         numbered from the BSP's up, as QEMU does. With a second CPU up
+ *         the kernel lock comes on, held by the boot code until the first
+ *         shell goes to user mode.
+ */
+uint32_t smp_init() {
+    uint32_t index, flags;
+    uint8_t bsp_id;
+    cpus[0].index = 0;
+    cpus[0].online = 1;
+    runqueue_init(&cpus[0].runqueue);
+    if (!SMP_ENABLE || !apic_active) return smp_num_cpus;
+    bsp_id = lapic_read(LAPIC_ID) >> 24;
+    cpus[0].apic_id = bsp_id;
+
+    trampoline_setup();
+    for (index = 1; index < SMP_MAX_CPUS; index++) {
+        if (!smp_start_ap(bsp_id + index, index)) break;
+        smp_num_cpus++;
+    }
+    for (index = 0; index < NUM_TERMINALS; index++)
+        terminal_cpu[index] = index % smp_num_cpus;
+    if (smp_num_cpus > 1) {
+        irqoff_save(flags);
+        spin_lock(&kernel_lock);
+        cpus[0].kernel_depth = 1;
+        kernel_lock_on = 1;
+        irqoff_restore(flags);
+    }
+    return smp_num_cpus;
+}
+
+/**
+ * Wakes up another CPU.
+ * INPUT: cpu: Index into cpus[]
+ * OUTPUT: None
+ * EFFECT: Nothing for the calling CPU itself or one that isn't up.
+ */
+void smp_kick(uint32_t cpu) {
+    if (cpu >= smp_num_cpus || cpu == smp_this_cpu()->index) return;
+    lapic_send_ipi(cpus[cpu].apic_id, ICR_FIXED | VEC_SMP_KICK);
+}
+
+/**
+ * Maps the calling CPU's video page at VIDMAP_ADDR.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: Only the CPU's own table and directory change, another CPU may
+ *         have its table cached in its TLB. video_remap keeps the entry
+ *         on the CPU's terminal from then on.
+ */
+void smp_vidmap() {
+    cpu_t* cpu = smp_this_cpu();
+    uint32_t* own = vidmap_table[cpu->index];
+    uint32_t* low_table = (uint32_t*)(cpu->pgdir[0] & PAGE_FRAME_MASK);
+    uint32_t flags;
+    irqoff_save(flags);
+    memset(own, 0, sizeof(vidmap_table[cpu->index]));
+    own[0] = (low_table[VIDEO >> 12] & PAGE_FRAME_MASK) | PTE_USER_RW;
+    cpu->pgdir[VIDMAP_PDE_INDEX] = (uint32_t)own | PTE_USER_RW;
+    invlpg(VIDMAP_ADDR);
+    vidmap_used = 1;
+    irqoff_restore(flags);
+}
+
+/**
+ * Maps video memory for a process about to run, if this CPU didn't yet.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: A process that called vidmap elsewhere may be handed over.
+ */
+void smp_vidmap_load() {
+    if (vidmap_used && !(smp_this_cpu()->pgdir[VIDMAP_PDE_INDEX] & PAGE_PRESENT))
+        smp_vidmap();
+}
+
+/* The calling CPU holds the lock now. Whoever held it before may have
+ * left the shared cursor and this CPU's view of it on another terminal. */
+static void kernel_lock_owned(cpu_t* cpu, uint32_t depth) {
+    cpu->kernel_depth = depth;
+    if (kernel_lock_owner != cpu->index) {
+        kernel_lock_owner = cpu->index;
+        set_terminal_vmem(cpu->terminal);
+    }
+}
+
+static void kernel_lock_drop(cpu_t* cpu) {
+    backup_cursor(cpu->terminal);
+    cpu->kernel_depth = 0;
+    spin_unlock(&kernel_lock);
+}
+
+/**
+ * Kernel entry, from every stub in isr.S and syscall.S.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: Nested entries only count. A CPU that doesn't run processes
+ *         yet, an AP in ap_main, doesn't take the lock at all.
+ */
+void kernel_enter() {
+    cpu_t* cpu;
+    uint32_t flags;
+    if (!kernel_lock_on) return;
+    irqoff_save(flags);
+    cpu = smp_this_cpu();
+    if (cpu->kernel_depth) {
+        cpu->kernel_depth++;
+    } else if (cpu->scheduling) {
+        spin_lock(&kernel_lock);
+        kernel_lock_owned(cpu, 1);
+    }
+    irqoff_restore(flags);
+}
+
+/**
+ * Kernel exit, from interrupt_return and wherever else the kernel irets
+ * to user mode.
+ * INPUT: cs: Code segment about to be returned to
+ * OUTPUT: None
+ */
+void kernel_exit(uint32_t cs) {
+    cpu_t* cpu;
+    uint32_t flags;
+    if (!kernel_lock_on) return;
+    irqoff_save(flags);
+    cpu = smp_this_cpu();
+    if (cpu->kernel_depth && (cs == USER_CS || !--cpu->kernel_depth))
+        kernel_lock_drop(cpu);
+    irqoff_restore(flags);
+}
+
+/**
+ * Lets go of the kernel lock before halting.
+ * INPUT: None
+ * OUTPUT: Depth to pass to kernel_relock
+ * EFFECT: Call with interrupts off. Interrupts taken while halted take
+ *         the lock for themselves.
+ */
+uint32_t kernel_unlock_all() {
+    cpu_t* cpu = smp_this_cpu();
+    uint32_t depth = cpu->kernel_depth;
+    if (depth) kernel_lock_drop(cpu);
+    return depth;
+}
+
+/**
+ * Takes the kernel lock back after a halt.
+ * INPUT: depth: From kernel_unlock_all
+ * OUTPUT: None
+ */
+void kernel_relock(uint32_t depth) {
+    if (!depth) return;
+    spin_lock(&kernel_lock);
+    kernel_lock_owned(smp_this_cpu(), depth);
+}
+
+/**
+ * context_switch that keeps the kernel lock depth with each context.
+ * INPUT: save_esp, next_esp: As for context_switch
+ * OUTPUT: None
+ * EFFECT: The lock stays held across the switch; the context parked here
+ *         gets its own depth back once something resumes it.
+ */
+void kernel_context_switch(uint32_t* save_esp, uint32_t next_esp) {
+    uint32_t depth = smp_this_cpu()->kernel_depth;
+    context_switch(save_esp, next_esp);
+    smp_this_cpu()->kernel_depth = depth;
+}
+
+/* Takes the oldest task off a queue, 0 if it was empty */
+static int32_t runqueue_pop(smp_runqueue_t* rq, smp_task_t* task) {
+    uint32_t flags;
+    int32_t found = 0;
+    spin_lock_irqsave(&rq->lock, flags);
+    if (rq->head != rq->tail) {
+        *task = rq->tasks[rq->tail & (SMP_QUEUE_SIZE - 1)];
+        rq->tail++;
+        found = 1;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return found;
+}
+
+/**
+ * Queues a task on a CPU.
+ * INPUT: cpu: Index into cpus[], fn/arg: The task
+ * OUTPUT: 0 on success, -1 if the CPU is offline or its queue is full
+ * EFFECT: An AP halted in its idle loop is woken with an IPI.
+ */
+int32_t smp_submit(uint32_t cpu, smp_fn_t fn, void* arg) {
+    smp_runqueue_t* rq;
+    uint32_t flags;
+    int32_t result = -1;
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online) return -1;
+    rq = &cpus[cpu].runqueue;
+    spin_lock_irqsave(&rq->lock, flags);
+    if (rq->head - rq->tail < SMP_QUEUE_SIZE) {
+        rq->tasks[rq->head & (SMP_QUEUE_SIZE - 1)].fn = fn;
+        rq->tasks[rq->head & (SMP_QUEUE_SIZE - 1)].arg = arg;
+        rq->head++;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    if (!result && cpu) smp_kick(cpu);
+    return result;
+}
+
+/* Tasks waiting on a CPU. Read without the lock, so only a hint. */
+static uint32_t runqueue_length(uint32_t cpu) {
+    return cpus[cpu].runqueue.head - cpus[cpu].runqueue.tail;
+}
+
+/**
+ * Work stealing for an idle CPU.
+ * INPUT: None
+ * OUTPUT: Number of tasks moved to the calling CPU's queue
+ * EFFECT: The victim keeps its oldest tasks, which it is about to run,
+ *         and the thief takes the newest half. The two locks are never
+ *         held together.
+ */
+uint32_t smp_steal() {
+    cpu_t* self = smp_this_cpu();
+    smp_runqueue_t* rq;
+    smp_task_t loot[SMP_QUEUE_SIZE / 2];
+    uint32_t cpu, victim = self->index, longest = 0, count, i, flags;
+    if (!smp_steal_enable) return 0;
+    for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+        if (cpu != self->index && runqueue_length(cpu) > longest) {
+            longest = runqueue_length(cpu);
+            victim = cpu;
+        }
+    }
+    if (victim == self->index) return 0;
+
+    rq = &cpus[victim].runqueue;
+    spin_lock_irqsave(&rq->lock, flags);
+    count = (rq->head - rq->tail + 1) / 2;
+    for (i = 0; i < count; i++) {
+        rq->head--;
+        loot[count - 1 - i] = rq->tasks[rq->head & (SMP_QUEUE_SIZE - 1)];
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    if (!count) return 0;
+
+    // Our queue was empty a moment ago, but a submit may have raced in
+    rq = &self->runqueue;
+    spin_lock_irqsave(&rq->lock, flags);
+    for (i = 0; i < count && rq->head - rq->tail < SMP_QUEUE_SIZE; i++) {
+        rq->tasks[rq->head & (SMP_QUEUE_SIZE - 1)] = loot[i];
+        rq->head++;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    for (; i < count; i++) {
+        loot[i].fn(loot[i].arg);
+        self->tasks_run++;
+    }
+    self->steals++;
+    self->tasks_stolen += count;
+    return count;
+}
+
+/**
+ * Drains the calling CPU's run queue, with interrupts as the caller had
+ * them while each task runs.
+ * INPUT: None
+ * OUTPUT: Number of tasks run
+ */
+uint32_t smp_run_pending() {
+    cpu_t* cpu = smp_this_cpu();
+    smp_task_t task;
+    uint32_t count = 0;
+    while (runqueue_pop(&cpu->runqueue, &task)) {
+        task.fn(task.arg);
+        cpu->tasks_run++;
+        count++;
+    }
+    return count;
+}
+
+/* proc/cpus: queue length and steal counts per CPU */
+void smp_info(procfs_out_t* out) {
+    uint32_t i;
+    procfs_puts(out, "CPU  APIC  QUEUED       RUN    STEALS    STOLEN  MIGRATED\n");
+    for (i = 0; i < smp_num_cpus; i++) {
+        procfs_putu(out, i, 3);
+        procfs_putu(out, cpus[i].apic_id, 6);
+        procfs_putu(out, runqueue_length(i), 8);
+        procfs_putu(out, cpus[i].tasks_run, 10);
+        procfs_putu(out, cpus[i].steals, 10);
+        procfs_putu(out, cpus[i].tasks_stolen, 10);
+        procfs_putu(out, cpus[i].migrations, 10);
+        procfs_puts(out, "\n");
+    }
+}
+
+/* Starts the shell of a terminal of this AP that was just visited, on
+ * the AP's boot stack, the way kernel.c starts the BSP's first one, or
+ * resumes the process of a terminal a busier CPU handed over. From then
+ * on the AP schedules its terminals from its own tick. Only comes back if
+ * execute failed. */
+static void ap_start_shell(cpu_t* cpu) {
+    int32_t terminal;
+    uint32_t boot_esp;
+    // Don't wait: whoever holds the lock may be waiting for our tasks
+    if (!spin_trylock(&kernel_lock)) return;
+    terminal = sched_pick_next();
+    if (terminal == -1) {
+        spin_unlock(&kernel_lock);
+        return;
+    }
+    cpu->scheduling = 1;
+    active_terminal = previous_terminal = terminal;
+    kernel_lock_owned(cpu, 1);
+    // Also when this CPU held the lock last, the terminal is new
+    set_terminal_vmem(terminal);
+    if (terminals[terminal].pid) {
+        terminals[terminal].pid = sched_pick_process(terminal);
+        process_resume(terminals[terminal].pid, &boot_esp);
+    }
+    sti();
+    execute("shell");
+    cli();
+    cpu->scheduling = 0;
+    kernel_lock_drop(cpu);
+}
+
+/**
+ * C entry of every AP.
+ * INPUT: None
+ * OUTPUT: Never returns
+ * EFFECT: Shares the BSP's IDT, loads its own TSS, turns on its LAPIC
+ *         and FPU, and checks in. It then halts between batches of tasks
+ *         until one of its terminals is visited. Device interrupts stay
+ *         routed to the BSP; an AP gets IPIs and its own timer tick.
+ */
+void ap_main() {
+    cpu_t* cpu = &cpus[ap_booting];
+    asm volatile("lidt %0" : : "m"(idt_desc_ptr));
+    ltr(AP_TSS(cpu->index));
+    lapic_init_cpu();
+    fpu_init();
+    cpu->online = 1;
+    lapic_timer_start(VEC_SMP_TICK);
+    while (1) {
+        asm volatile("sti" : : : "memory");
+        do {
+            smp_run_pending();
+        } while (smp_steal());
+        // Only sleep if nothing came in since, sti;hlt can't miss the IPI
+        asm volatile("cli" : : : "memory");
+        if (kernel_lock_on && sched_pick_next() != -1) ap_start_shell(cpu);
+        if (cpu->runqueue.head == cpu->runqueue.tail)
+            asm volatile("sti; hlt" : : : "memory");
+    }
+}
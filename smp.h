@@ -0,0 +1,145 @@
+/* smp.h - Application processor bring-up, per-CPU data and run queues
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+
+/* Build with -DSMP_ENABLE=0 to leave the APs parked */
+#ifndef SMP_ENABLE
+#define SMP_ENABLE 1
+#endif
+
+#define SMP_MAX_CPUS 4
+#define SMP_STACK_SIZE 0x2000
+#define SMP_QUEUE_SIZE 64  /* Power of two */
+
+/* Real mode entry of the APs, copied to a free page under 1MB */
+#define AP_TRAMPOLINE 0x8000
+#define CR0_PE 0x1
+#define CR0_MP 0x2
+#define CR0_NE 0x20
+#define CR0_NW 0x20000000
+#define CR0_CD 0x40000000
+#define CR0_PG 0x80000000
+
+#ifndef ASM
+
+#include "spinlock.h"
+#include "x86_desc.h"
+#include "driver/procfs.h"
+
+typedef void (*smp_fn_t)(void* arg);
+
+typedef struct {
+    smp_fn_t fn;
+    void* arg;
+} smp_task_t;
+
+/* Kernel tasks waiting for a CPU, run to completion in FIFO order */
+typedef struct {
+    spinlock_t lock;
+    uint32_t head;  /* Free running, head - tail is the length */
+    uint32_t tail;
+    smp_task_t tasks[SMP_QUEUE_SIZE];
+} smp_runqueue_t;
+
+typedef struct {
+    uint8_t index;
+    uint8_t apic_id;
+    volatile uint8_t online;
+    uint32_t tasks_run;
+    uint32_t steals;  /* Times it pulled work from another queue */
+    uint32_t tasks_stolen;  /* Tasks it pulled */
+    uint32_t migrations;  /* Terminals it handed to idle CPUs */
+    uint32_t* stack_top;
+    smp_runqueue_t runqueue;
+    /* Running processes. Each terminal belongs to one CPU at a time, see
+     * smp_terminal_cpu; sched_balance moves it to an idle CPU, processes
+     * and all. */
+    int terminal;  /* active_terminal: terminals[terminal].pid runs here */
+    int prev_terminal;  /* previous_terminal */
+    tss_t* tss;
+    uint32_t* pgdir;  /* Own page directory, the user pages differ */
+    uint8_t fpu_pid;  /* Whose registers this CPU's FPU holds, see fpu_owner */
+    uint8_t scheduling;  /* Runs processes, so it takes the kernel lock */
+    volatile uint8_t in_idle;  /* Parked in the scheduler's idle context */
+    uint8_t need_resched;  /* Set by the tick, acted on by irq_exit */
+    uint32_t kernel_depth;  /* Kernel lock nesting, 0 if not held */
+} cpu_t;
+
+extern cpu_t cpus[SMP_MAX_CPUS];
+/* CPUs that came up, the BSP included */
+extern volatile uint32_t smp_num_cpus;
+/* Idle CPUs pull work from the busiest queue and busy CPUs hand their
+ * spare terminals to idle ones, 0 turns both off */
+extern uint8_t smp_steal_enable;
+/* Big kernel lock: the kernel was written for one CPU, so only one CPU at
+ * a time runs it on behalf of a process. User code runs in parallel. */
+extern spinlock_t kernel_lock;
+
+/* Starts the APs one LAPIC ID at a time, until one doesn't answer.
+ * Needs apic_init to have succeeded. Returns the number of CPUs. */
+uint32_t smp_init(void);
+
+/* The calling CPU's data. Each CPU loaded its own TSS selector into the
+ * task register, and STR reads it back without touching the LAPIC; a CPU
+ * that didn't load one yet reads 0, the BSP's. */
+static inline cpu_t* smp_this_cpu(void) {
+    uint16_t sel;
+    asm volatile("str %0" : "=r"(sel));
+    return &cpus[sel >= AP_TSS_BASE ? (sel - AP_TSS_BASE) / 8 + 1 : 0];
+}
+
+/* CPU whose scheduler runs a terminal's processes, and handing it to
+ * another one. Only the current owner may hand a terminal it isn't
+ * running, under the kernel lock. */
+uint32_t smp_terminal_cpu(int32_t terminal);
+void smp_set_terminal_cpu(int32_t terminal, uint32_t cpu);
+
+/* Wakes a CPU halted in its idle loop or in sched_sleep_on */
+void smp_kick(uint32_t cpu);
+
+/* Maps video memory at 136MB in a table of the calling CPU's own. Once a
+ * process did, smp_vidmap_load does it on every CPU that runs one. */
+void smp_vidmap(void);
+void smp_vidmap_load(void);
+
+/* Kernel lock, no-ops until a second CPU came up. The entry stubs call
+ * kernel_enter; kernel_exit gets the CS being returned to and lets go
+ * completely on the way to user mode. */
+void kernel_enter(void);
+void kernel_exit(uint32_t cs);
+
+/* Lets go around a halt, so the other CPUs keep going. Returns the depth
+ * to hand back to kernel_relock once awake. */
+uint32_t kernel_unlock_all(void);
+void kernel_relock(uint32_t depth);
+
+/* context_switch between contexts that hold the kernel lock. Each keeps
+ * its own nesting depth. */
+void kernel_context_switch(uint32_t* save_esp, uint32_t next_esp);
+
+/* Queues fn(arg) on a CPU and wakes it up. Returns 0, or -1 if that CPU
+ * is offline or its queue is full. The BSP runs its own queue whenever
+ * it idles. */
+int32_t smp_submit(uint32_t cpu, smp_fn_t fn, void* arg);
+
+/* Runs everything queued on the calling CPU. Returns the count run. */
+uint32_t smp_run_pending(void);
+
+/* Moves half of the busiest other queue onto the calling CPU's.
+ * Returns the number of tasks taken. */
+uint32_t smp_steal(void);
+
+/* proc/cpus: queue length and steal counts per CPU */
+void smp_info(procfs_out_t* out);
+
+/* Entry point of every AP, from the trampoline */
+void ap_main(void);
+
+#endif /* ASM */
+
+#endif /* _SMP_H */
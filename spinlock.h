@@ -0,0 +1,68 @@
+/* spinlock.h - Spinlocks and atomic counters for code shared between CPUs
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+#include "irqoff.h"
+
+#ifndef ASM
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+/* Test and test-and-set: waiters spin on a plain read, so the cache line
+ * isn't bounced around until the holder lets go */
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t taken = 1;
+    while (1) {
+        asm volatile("xchgl %0, %1" : "+r"(taken), "+m"(lock->locked) : : "memory");
+        if (!taken) return;
+        while (lock->locked) asm volatile("pause");
+        taken = 1;
+    }
+}
+
+/* One attempt, returns 1 if it got the lock */
+static inline int32_t spin_trylock(spinlock_t* lock) {
+    uint32_t taken = 1;
+    asm volatile("xchgl %0, %1" : "+r"(taken), "+m"(lock->locked) : : "memory");
+    return !taken;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    asm volatile("" : : : "memory");  // x86 stores aren't reordered with earlier ones
+    lock->locked = 0;
+}
+
+/* The usual kernel critical section: interrupts off on this CPU, and the
+ * lock keeps the other CPUs out */
+#define spin_lock_irqsave(lock, flags)                                         \
+    do {                                                                       \
+        irqoff_save(flags);                                                    \
+        spin_lock(lock);                                                       \
+    } while (0)
+
+#define spin_unlock_irqrestore(lock, flags)                                    \
+    do {                                                                       \
+        spin_unlock(lock);                                                     \
+        irqoff_restore(flags);                                                 \
+    } while (0)
+
+static inline void atomic_inc(volatile uint32_t* value) {
+    asm volatile("lock incl %0" : "+m"(*value) : : "memory");
+}
+
+static inline void atomic_dec(volatile uint32_t* value) {
+    asm volatile("lock decl %0" : "+m"(*value) : : "memory");
+}
+
+#endif /* ASM */
+
+#endif /* _SPINLOCK_H */
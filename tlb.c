@@ -0,0 +1,75 @@
+#include "tlb.h"
+#include "lib.h"
+#include "irqoff.h"
+#include "smp.h"
+
+#define VIDMAP_ADDR (VIDMAP_PDE_INDEX << 22)
+
+extern uint32_t pgDir[];
+
+static uint8_t tlb_ready = 0;
+
+/* Page table covering the low 4MB, from the first directory entry. Each
+ * CPU has its own, the video page follows that CPU's terminal. */
+static uint32_t* low_page_table() {
+    return (uint32_t*)(smp_this_cpu()->pgdir[0] & PAGE_FRAME_MASK);
+}
+
+/**
+ * Makes the kernel mappings global.
+ * INPUT: None
+ * OUTPUT: None
+ * EFFECT: Sets G on the kernel 4MB page and on every present low memory
+ *         page (video memory and the terminal buffers), then enables
+ *         CR4.PGE. Safe to call more than once.
+ */
+void tlb_init() {
+    uint32_t* table;
+    uint32_t i;
+    if (tlb_ready) return;
+    if (pgDir[KERNEL_PDE_INDEX] & PAGE_PRESENT)
+        pgDir[KERNEL_PDE_INDEX] |= PAGE_GLOBAL;
+    if (pgDir[0] & PAGE_PRESENT) {
+        table = low_page_table();
+        for (i = 0; i < 1024; i++)
+            if (table[i] & PAGE_PRESENT) table[i] |= PAGE_GLOBAL;
+    }
+    tlb_set_global(1);
+    tlb_ready = 1;
+}
+
+/**
+ * Enables or disables CR4.PGE.
+ * INPUT: enable: 1 to turn global pages on
+ * OUTPUT: None
+ */
+void tlb_set_global(uint8_t enable) {
+    uint32_t cr4 = read_cr4();
+    write_cr4(enable ? (cr4 | CR4_PGE) : (cr4 & ~CR4_PGE));
+}
+
+/**
+ * Remaps video memory for the kernel and for vidmap.
+ * INPUT: target_phys_addr: VIDEO or a terminal's offscreen buffer
+ * OUTPUT: None
+ * EFFECT: The kernel video page is global, so it has to be invalidated by
+ *         hand; a CR3 reload wouldn't drop it.
+ */
+void video_remap(uint32_t target_phys_addr) {
+    uint32_t* table = low_page_table();
+    uint32_t* pgdir = smp_this_cpu()->pgdir;
+    uint32_t* vidmap_table;
+    uint32_t index = VIDEO >> 12;
+    uint32_t flags;
+    irqoff_save(flags);
+    if ((table[index] & PAGE_FRAME_MASK) != target_phys_addr) {
+        table[index] = (table[index] & ~PAGE_FRAME_MASK) | target_phys_addr;
+        invlpg(VIDEO);
+        if (pgdir[VIDMAP_PDE_INDEX] & PAGE_PRESENT) {
+            vidmap_table = (uint32_t*)(pgdir[VIDMAP_PDE_INDEX] & PAGE_FRAME_MASK);
+            vidmap_table[0] = (vidmap_table[0] & ~PAGE_FRAME_MASK) | target_phys_addr;
+            invlpg(VIDMAP_ADDR);
+        }
+    }
+    irqoff_restore(flags);
+}
@@ -0,0 +1,51 @@
+/* tlb.h - Global kernel pages and targeted TLB invalidation
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _TLB_H
+#define _TLB_H
+
+#include "types.h"
+
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+#define PAGE_PRESENT 0x1
+#define PAGE_GLOBAL 0x100
+#define PAGE_FRAME_MASK 0xFFFFF000
+
+#define KERNEL_PDE_INDEX 1  /* 4MB-8MB, kernel image */
+#define VIDMAP_PDE_INDEX 34  /* 136MB, user view of video memory */
+
+#ifndef ASM
+
+/* Drops the TLB entry of one page, a 4MB one included */
+static inline void invlpg(uint32_t addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint32_t cr4) {
+    asm volatile("movl %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/* Marks the kernel page and low memory global and turns on CR4.PGE, so
+ * CR3 reloads on process switches keep those translations */
+void tlb_init(void);
+
+/* Turns global pages on or off, only meant for benchmarks. Toggling
+ * CR4.PGE flushes the whole TLB. */
+void tlb_set_global(uint8_t enable);
+
+/* Points the kernel video page (and the vidmap page) at target_phys_addr.
+ * Same job as switch_vid_address() but only invalidates the two pages it
+ * touches, and does nothing if the mapping is already right. */
+void video_remap(uint32_t target_phys_addr);
+
+#endif /* ASM */
+
+#endif /* _TLB_H */
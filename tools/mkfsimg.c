@@ -0,0 +1,227 @@
+/* mkfsimg.c - Builds a boot filesystem image, large files included
+ * vim:ts=4 noexpandtab
+ *
+ * Host tool, build with: gcc -O2 -o mkfsimg mkfsimg.c
+ *
+ * Usage: mkfsimg [-x] [-e blocks] -o fsys.img file...
+ *
+ * The image gets "." and "rtc" followed by one regular file per argument,
+ * named after its last path component. Each file's data blocks are laid
+ * out consecutively. A file that fits a flat inode (1023 blocks, just under
+ * 4MB) gets one, so an image without large files is in the original
+ * format. Bigger files, or every file with -x, get an extended inode (see
+ * fsext.h): extents, then indirect blocks once the inline ones run out.
+ * -e caps the blocks per extent, only useful to exercise the indirect
+ * blocks without multi-megabyte inputs.
+ */
+
+/* Layout constants and magics come straight from the kernel header, ASM
+ * keeps the kernel's own types out */
+#define ASM 1
+#include "../fsext.h"
+#undef ASM
+#undef NULL
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_DENTRIES 63
+#define NAME_LENGTH 32
+#define TYPE_RTC 0
+#define TYPE_DIR 1
+#define TYPE_FILE 2
+#define FIXED_DENTRIES 2  /* "." and "rtc" */
+
+/* Same layouts as the kernel's boot block, dentry and fsext_inode_t */
+typedef struct {
+    char name[NAME_LENGTH];
+    uint32_t type, inode;
+    uint8_t reserved[24];
+} dentry_t;
+
+typedef struct {
+    uint32_t num_dentries, num_inodes, num_data_blocks;
+    uint32_t reserved[13];
+    dentry_t dentries[MAX_DENTRIES];
+} boot_t;
+
+typedef struct {
+    uint32_t block, count;
+} extent_t;
+
+typedef struct {
+    uint32_t length, magic, num_extents;
+    uint32_t indirect[FSEXT_INDIRECT];
+    extent_t extents[FSEXT_INLINE_EXTENTS];
+    uint32_t reserved;
+} ext_inode_t;
+
+typedef struct {
+    const char* name;
+    uint8_t* data;
+    uint32_t length;
+    uint32_t first_block, num_blocks;
+    uint32_t num_extents, extent_blocks;
+    uint32_t first_indirect;
+    int extended;
+} file_t;
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-x] [-e blocks] -o fsys.img file...\n", prog);
+    exit(2);
+}
+
+static void load_file(file_t* file, const char* path) {
+    FILE* in = fopen(path, "rb");
+    long size;
+    const char* slash = strrchr(path, '/');
+    file->name = slash ? slash + 1 : path;
+    if (!*file->name || strlen(file->name) > NAME_LENGTH) {
+        fprintf(stderr, "%s: name must be 1 to %d characters\n", path, NAME_LENGTH);
+        exit(1);
+    }
+    if (!in || fseek(in, 0, SEEK_END) || (size = ftell(in)) < 0 ||
+        size > 0x7FFFFFFFL || fseek(in, 0, SEEK_SET)) {
+        perror(path);
+        exit(1);
+    }
+    file->length = (uint32_t)size;
+    file->data = malloc(size ? size : 1);
+    if (!file->data || fread(file->data, 1, size, in) != (size_t)size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(in);
+    file->num_blocks = (file->length + FSEXT_BLOCK_SIZE - 1) / FSEXT_BLOCK_SIZE;
+}
+
+/* Extent n of a file, inline or in one of its indirect blocks */
+static extent_t* extent_slot(uint8_t* image, uint32_t num_inodes, ext_inode_t* node,
+                             const file_t* file, uint32_t n) {
+    uint32_t block;
+    if (n < FSEXT_INLINE_EXTENTS) return &node->extents[n];
+    n -= FSEXT_INLINE_EXTENTS;
+    block = file->first_indirect + n / FSEXT_EXTENTS_PER_BLOCK;
+    node->indirect[n / FSEXT_EXTENTS_PER_BLOCK] = block;
+    return (extent_t*)(image + (size_t)(1 + num_inodes + block) * FSEXT_BLOCK_SIZE) +
+           n % FSEXT_EXTENTS_PER_BLOCK;
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = NULL;
+    uint32_t max_extent = 0, num_files, next_block = 0, i, j, n;
+    int force_extended = 0, any_extended = 0, opt;
+    file_t files[MAX_DENTRIES];
+    uint8_t* image;
+    size_t image_size;
+    boot_t* boot;
+    FILE* out;
+
+    while ((opt = getopt(argc, argv, "xe:o:")) != -1) {
+        switch (opt) {
+            case 'x': force_extended = 1; break;
+            case 'e': max_extent = strtoul(optarg, NULL, 0); break;
+            case 'o': out_path = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    num_files = argc - optind;
+    if (!out_path || !num_files) usage(argv[0]);
+    if (num_files > MAX_DENTRIES - FIXED_DENTRIES) {
+        fprintf(stderr, "at most %d files fit the directory\n",
+                MAX_DENTRIES - FIXED_DENTRIES);
+        return 1;
+    }
+
+    /* Pass 1: data blocks of each file, then its indirect blocks */
+    memset(files, 0, sizeof(files));
+    for (i = 0; i < num_files; i++) {
+        file_t* file = &files[i];
+        load_file(file, argv[optind + i]);
+        for (j = 0; j < i; j++) {
+            if (!strncmp(files[j].name, file->name, NAME_LENGTH)) {
+                fprintf(stderr, "%s: duplicate name\n", file->name);
+                return 1;
+            }
+        }
+        file->first_block = next_block;
+        next_block += file->num_blocks;
+        file->extended = force_extended || file->num_blocks > FSEXT_FLAT_BLOCKS;
+        if (!file->extended) continue;
+        any_extended = 1;
+        file->extent_blocks = max_extent ? max_extent : file->num_blocks;
+        if (!file->extent_blocks) file->extent_blocks = 1;
+        file->num_extents = (file->num_blocks + file->extent_blocks - 1) / file->extent_blocks;
+        if (file->num_extents > FSEXT_MAX_EXTENTS) {
+            fprintf(stderr, "%s: %u extents, at most %d fit\n", file->name,
+                    file->num_extents, FSEXT_MAX_EXTENTS);
+            return 1;
+        }
+        file->first_indirect = next_block;
+        if (file->num_extents > FSEXT_INLINE_EXTENTS)
+            next_block += (file->num_extents - FSEXT_INLINE_EXTENTS +
+                           FSEXT_EXTENTS_PER_BLOCK - 1) / FSEXT_EXTENTS_PER_BLOCK;
+    }
+
+    image_size = (size_t)(1 + num_files + next_block) * FSEXT_BLOCK_SIZE;
+    image = calloc(1, image_size);
+    if (!image) {
+        perror("image");
+        return 1;
+    }
+
+    /* Pass 2: boot block, inodes and data */
+    boot = (boot_t*)image;
+    boot->num_dentries = num_files + FIXED_DENTRIES;
+    boot->num_inodes = num_files;
+    boot->num_data_blocks = next_block;
+    if (any_extended) ((uint32_t*)boot)[FSEXT_IMAGE_MAGIC_WORD] = FSEXT_IMAGE_MAGIC;
+    strcpy(boot->dentries[0].name, ".");
+    boot->dentries[0].type = TYPE_DIR;
+    strcpy(boot->dentries[1].name, "rtc");
+    boot->dentries[1].type = TYPE_RTC;
+    for (i = 0; i < num_files; i++) {
+        file_t* file = &files[i];
+        dentry_t* dentry = &boot->dentries[FIXED_DENTRIES + i];
+        uint8_t* inode = image + (size_t)(1 + i) * FSEXT_BLOCK_SIZE;
+        strncpy(dentry->name, file->name, NAME_LENGTH);
+        dentry->type = TYPE_FILE;
+        dentry->inode = i;
+        memcpy(image + (size_t)(1 + num_files + file->first_block) * FSEXT_BLOCK_SIZE,
+               file->data, file->length);
+        if (file->extended) {
+            ext_inode_t* node = (ext_inode_t*)inode;
+            node->length = file->length;
+            node->magic = FSEXT_INODE_MAGIC;
+            node->num_extents = file->num_extents;
+            for (n = 0; n < file->num_extents; n++) {
+                extent_t* extent = extent_slot(image, num_files, node, file, n);
+                extent->block = file->first_block + n * file->extent_blocks;
+                extent->count = file->num_blocks - n * file->extent_blocks;
+                if (extent->count > file->extent_blocks) extent->count = file->extent_blocks;
+            }
+        } else {
+            uint32_t* words = (uint32_t*)inode;
+            words[0] = file->length;
+            for (n = 0; n < file->num_blocks; n++) words[1 + n] = file->first_block + n;
+        }
+        printf("%-32s %10u bytes  %s", file->name, file->length,
+               file->extended ? "extended" : "flat");
+        if (file->extended) printf(", %u extents", file->num_extents);
+        printf("\n");
+        free(file->data);
+    }
+
+    out = fopen(out_path, "wb");
+    if (!out || fwrite(image, 1, image_size, out) != image_size || fclose(out)) {
+        perror(out_path);
+        return 1;
+    }
+    printf("%s: %u files, %u data blocks, %s format\n", out_path, num_files,
+           next_block, any_extended ? "extended" : "flat");
+    free(image);
+    return 0;
+}
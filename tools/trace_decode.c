@@ -0,0 +1,262 @@
+/* trace_decode.c - Renders a flight recorder dump as a timeline
+ * vim:ts=4 noexpandtab
+ *
+ * Host tool, build with: gcc -O2 -o trace_decode trace_decode.c
+ *
+ * Input is whatever came back from the trace_dump syscall (15), usually
+ * written to /dev/serial by a user program and captured on the host with
+ * QEMU's -serial file:capture.bin. The dump is found by its magic, so
+ * terminal output mirrored to the same port around it does no harm.
+ *
+ * Events from every CPU are merged by TSC. Syscalls and interrupts get
+ * their duration, and the ones longer than the threshold (-t, in
+ * microseconds) are flagged with '!' so latency spikes stand out. A
+ * summary per syscall and per IRQ line closes the output.
+ */
+
+/* Event numbers, the magic and the vectors come straight from the kernel
+ * headers, ASM keeps the kernel's own types out */
+#define ASM 1
+#include "../trace.h"
+#include "../interrupt/vectors.h"
+#undef ASM
+#undef NULL
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CPUS 16
+#define STACK_DEPTH 16
+#define NUM_SYSCALLS 17
+#define NUM_IRQ_LINES 16
+
+/* Same layout as trace_event_t and trace_header_t, no padding on either side */
+typedef struct {
+    uint32_t tsc_lo, tsc_hi;
+    uint8_t type, cpu, pid, reserved;
+    uint32_t arg0, arg1;
+} event_t;
+
+typedef struct {
+    uint32_t magic, num_events, num_cpus, tick_rate;
+    uint32_t epoch_tsc_lo, epoch_tsc_hi, epoch_ticks;
+    uint32_t dump_tsc_lo, dump_tsc_hi, dump_ticks;
+    uint32_t lost;
+} header_t;
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t order;  /* Position in the dump, keeps sorting stable */
+    event_t event;
+} entry_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t total;
+    uint64_t max;
+} latency_t;
+
+static const char* syscall_names[NUM_SYSCALLS] = {
+    "?", "halt", "execute", "read", "write", "open", "close", "getargs",
+    "vidmap", "set_handler", "sigreturn", "pipe", "shmget", "shmat", "shmdt",
+    "trace_dump", "waitpid"};
+
+static double cycles_per_us;  /* 0 when the dump can't be calibrated */
+static double threshold_us = 100.0;
+
+static uint64_t join(uint32_t lo, uint32_t hi) {
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static double to_us(uint64_t cycles) {
+    return cycles_per_us ? cycles / cycles_per_us : (double)cycles;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const entry_t* x = a;
+    const entry_t* y = b;
+    if (x->tsc != y->tsc) return x->tsc < y->tsc ? -1 : 1;
+    return x->order < y->order ? -1 : 1;
+}
+
+static const char* syscall_name(uint32_t number) {
+    return number < NUM_SYSCALLS ? syscall_names[number] : "?";
+}
+
+static void account(latency_t* stat, uint64_t cycles) {
+    stat->count++;
+    stat->total += cycles;
+    if (cycles > stat->max) stat->max = cycles;
+}
+
+static char flag(uint64_t cycles) {
+    return to_us(cycles) > threshold_us ? '!' : ' ';
+}
+
+/* Loads a whole file, NULL on failure */
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    uint8_t* data;
+    long length;
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(length > 0 ? length : 1);
+    if (!data || fread(data, 1, length, f) != (size_t)length) {
+        fclose(f);
+        free(data);
+        return 0;
+    }
+    fclose(f);
+    *size = length;
+    return data;
+}
+
+int main(int argc, char** argv) {
+    uint32_t magic = TRACE_MAGIC;
+    uint32_t stack_number[MAX_CPUS][STACK_DEPTH];
+    uint64_t stack_tsc[MAX_CPUS][STACK_DEPTH];
+    uint32_t depth[MAX_CPUS] = {0};
+    latency_t syscalls[NUM_SYSCALLS] = {{0}};
+    latency_t irqs[NUM_IRQ_LINES] = {{0}};
+    uint8_t* data;
+    size_t size, offset;
+    header_t header;
+    entry_t* entries;
+    uint32_t i, n, cpu, number, line;
+    uint64_t ticks, first, cycles;
+    const char* path = 0;
+
+    for (i = 1; i < (uint32_t)argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < (uint32_t)argc)
+            threshold_us = atof(argv[++i]);
+        else
+            path = argv[i];
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [-t threshold_us] capture\n", argv[0]);
+        return 1;
+    }
+    data = read_file(path, &size);
+    if (!data) {
+        perror(path);
+        return 1;
+    }
+
+    // STEP 1: Find the dump, wherever it landed in the capture
+    for (offset = 0; offset + sizeof(header) <= size; offset++)
+        if (!memcmp(data + offset, &magic, sizeof(magic))) break;
+    if (offset + sizeof(header) > size) {
+        fprintf(stderr, "%s: no trace dump found\n", path);
+        return 1;
+    }
+    memcpy(&header, data + offset, sizeof(header));
+    offset += sizeof(header);
+    n = header.num_events;
+    if (n > (size - offset) / sizeof(event_t)) {
+        n = (size - offset) / sizeof(event_t);
+        fprintf(stderr, "%s: capture cut short, %u of %u events\n", path, n,
+                header.num_events);
+    }
+
+    // STEP 2: Cycles per microsecond from the two (tsc, tick) pairs
+    ticks = header.dump_ticks - header.epoch_ticks;
+    if (ticks && header.tick_rate)
+        cycles_per_us = (join(header.dump_tsc_lo, header.dump_tsc_hi) -
+                         join(header.epoch_tsc_lo, header.epoch_tsc_hi)) *
+                        (double)header.tick_rate / ticks / 1e6;
+
+    // STEP 3: Merge the CPUs, dropping slots that were being written
+    entries = malloc((n ? n : 1) * sizeof(entry_t));
+    if (!entries) return 1;
+    for (i = 0, number = 0; i < n; i++) {
+        event_t* event = &entries[number].event;
+        memcpy(event, data + offset + i * sizeof(event_t), sizeof(event_t));
+        if (event->type == TRACE_EV_NONE || event->type > TRACE_EV_HALT ||
+            event->cpu >= MAX_CPUS)
+            continue;
+        entries[number].tsc = join(event->tsc_lo, event->tsc_hi);
+        entries[number].order = i;
+        number++;
+    }
+    n = number;
+    qsort(entries, n, sizeof(entry_t), compare_entries);
+
+    printf("%u events from %u CPUs, %u lost, ", n, header.num_cpus, header.lost);
+    if (cycles_per_us)
+        printf("%.1f cycles/us, flagging over %.1f us\n", cycles_per_us,
+               threshold_us);
+    else
+        printf("uncalibrated: times are in cycles\n");
+    printf("%12s  cpu  pid  event\n", cycles_per_us ? "time (us)" : "cycles");
+
+    // STEP 4: Timeline
+    first = n ? entries[0].tsc : 0;
+    for (i = 0; i < n; i++) {
+        event_t* e = &entries[i].event;
+        cpu = e->cpu;
+        printf("%12.1f  %3u  %3u  ", to_us(entries[i].tsc - first), cpu, e->pid);
+        switch (e->type) {
+        case TRACE_EV_SYSCALL_ENTER:
+            printf("  %s(%u)\n", syscall_name(e->arg0), e->arg0);
+            if (depth[cpu] < STACK_DEPTH) {
+                stack_number[cpu][depth[cpu]] = e->arg0;
+                stack_tsc[cpu][depth[cpu]] = entries[i].tsc;
+            }
+            depth[cpu]++;
+            break;
+        case TRACE_EV_SYSCALL_EXIT:
+            // execute returns after its child halts, so calls nest
+            if (depth[cpu] && depth[cpu] <= STACK_DEPTH) {
+                depth[cpu]--;
+                number = stack_number[cpu][depth[cpu]];
+                cycles = entries[i].tsc - stack_tsc[cpu][depth[cpu]];
+                printf("%c %s = %d, %.1f\n", flag(cycles), syscall_name(number),
+                       (int32_t)e->arg0, to_us(cycles));
+                if (number < NUM_SYSCALLS) account(&syscalls[number], cycles);
+            } else {
+                if (depth[cpu]) depth[cpu]--;
+                printf("  syscall = %d\n", (int32_t)e->arg0);
+            }
+            break;
+        case TRACE_EV_SWITCH:
+            printf("  switch %u -> %u\n", e->arg0, e->arg1);
+            break;
+        case TRACE_EV_IRQ:
+            line = e->arg0 - VEC_IRQ_BASE;
+            printf("%c irq %u, %.1f\n", flag(e->arg1), line, to_us(e->arg1));
+            if (line < NUM_IRQ_LINES) account(&irqs[line], e->arg1);
+            break;
+        case TRACE_EV_PAGE_FAULT:
+            printf("  page fault at 0x%08x, eip 0x%08x\n", e->arg0, e->arg1);
+            break;
+        case TRACE_EV_EXECUTE:
+            printf("  execute pid %u, parent %u\n", e->arg0, e->arg1);
+            break;
+        case TRACE_EV_HALT:
+            printf("  halt pid %u, status %u\n", e->arg0, e->arg1);
+            break;
+        }
+    }
+
+    // STEP 5: Summary
+    printf("\n%-12s %8s %12s %12s\n", "syscall", "count", "avg", "max");
+    for (i = 1; i < NUM_SYSCALLS; i++) {
+        if (!syscalls[i].count) continue;
+        printf("%-12s %8u %12.1f %12.1f\n", syscall_names[i], syscalls[i].count,
+               to_us(syscalls[i].total / syscalls[i].count),
+               to_us(syscalls[i].max));
+    }
+    printf("\n%-12s %8s %12s %12s\n", "irq", "count", "avg", "max");
+    for (i = 0; i < NUM_IRQ_LINES; i++) {
+        if (!irqs[i].count) continue;
+        printf("%-12u %8u %12.1f %12.1f\n", i, irqs[i].count,
+               to_us(irqs[i].total / irqs[i].count), to_us(irqs[i].max));
+    }
+    free(entries);
+    free(data);
+    return 0;
+}
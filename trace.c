@@ -0,0 +1,139 @@
+#include "trace.h"
+#include "smp.h"
+#include "tsc.h"
+#include "uaccess.h"
+#include "driver/pit.h"
+#include "driver/terminal.h"
+#include "interrupt/sched.h"
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+#define trace_barrier() asm volatile("" : : : "memory")
+
+/* Only ever written by their own CPU. head counts every slot claimed, the
+ * ring holds the last TRACE_RING_SIZE of them. */
+static struct {
+    volatile uint32_t head;
+    trace_event_t events[TRACE_RING_SIZE];
+} rings[SMP_MAX_CPUS];
+
+/* First calibration point for the decoder, the dump takes the second */
+static uint64_t epoch_tsc;
+static uint32_t epoch_ticks;
+
+void trace_record(uint8_t type, uint32_t arg0, uint32_t arg1) {
+    uint32_t cpu = smp_this_cpu()->index;
+    uint32_t slot = 1;
+    uint64_t now = rdtsc();
+    trace_event_t* event;
+    if (!epoch_tsc) {
+        epoch_ticks = (uint32_t)sched_total_ticks;
+        epoch_tsc = now;
+    }
+    asm volatile("xaddl %0, %1" : "+r"(slot), "+m"(rings[cpu].head)
+                 : : "memory");
+    event = &rings[cpu].events[slot & TRACE_RING_MASK];
+    // type goes last, a reader skips slots still at TRACE_EV_NONE
+    event->type = TRACE_EV_NONE;
+    trace_barrier();
+    event->tsc_lo = (uint32_t)now;
+    event->tsc_hi = (uint32_t)(now >> 32);
+    event->cpu = cpu;
+    // Each CPU's own process, 0 on an AP that only runs kernel tasks
+    event->pid = terminals[active_terminal].pid;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+    trace_barrier();
+    event->type = type;
+}
+
+void trace_syscall_enter(uint32_t number) {
+    trace_record(TRACE_EV_SYSCALL_ENTER, number, 0);
+}
+
+void trace_syscall_exit(int32_t result) {
+    trace_record(TRACE_EV_SYSCALL_EXIT, result, 0);
+}
+
+/**
+ * Copies the flight recorder out.
+ * INPUT: buf: User buffer, nbytes: its size
+ * OUTPUT: Bytes written, -1 on a bad buffer
+ * EFFECT: Events come out per CPU, oldest first. When buf is too small,
+ *         each CPU keeps its newest events, the lower CPUs first. The rings
+ *         keep recording meanwhile, so an event being overwritten right
+ *         then can come out torn; the decoder drops unknown types.
+ */
+int32_t trace_dump(void* buf, int32_t nbytes) {
+    trace_header_t header;
+    uint32_t cpu, head, start, count, room, first, lost = 0;
+    uint8_t* out = (uint8_t*)buf + sizeof(header);
+    uint64_t now = rdtsc();
+    if (nbytes < (int32_t)sizeof(header) || !user_range_ok(buf, nbytes))
+        return -1;
+    room = (nbytes - sizeof(header)) / sizeof(trace_event_t);
+    header.num_events = 0;
+    for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+        head = rings[cpu].head;
+        start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        lost += start;
+        count = head - start;
+        if (count > room) {
+            lost += count - room;
+            start = head - room;
+            count = room;
+        }
+        // At most two pieces, split where the ring wraps
+        first = TRACE_RING_SIZE - (start & TRACE_RING_MASK);
+        if (first > count) first = count;
+        if (__copy_user(out, &rings[cpu].events[start & TRACE_RING_MASK],
+                        first * sizeof(trace_event_t)) ||
+            __copy_user(out + first * sizeof(trace_event_t), rings[cpu].events,
+                        (count - first) * sizeof(trace_event_t)))
+            return -1;
+        out += count * sizeof(trace_event_t);
+        room -= count;
+        header.num_events += count;
+    }
+    header.magic = TRACE_MAGIC;
+    header.num_cpus = smp_num_cpus;
+    header.tick_rate = PIT_TICK_RATE;
+    header.epoch_tsc_lo = (uint32_t)epoch_tsc;
+    header.epoch_tsc_hi = (uint32_t)(epoch_tsc >> 32);
+    header.epoch_ticks = epoch_ticks;
+    header.dump_tsc_lo = (uint32_t)now;
+    header.dump_tsc_hi = (uint32_t)(now >> 32);
+    header.dump_ticks = (uint32_t)sched_total_ticks;
+    header.lost = lost;
+    if (__copy_user(buf, &header, sizeof(header))) return -1;
+    return (uint8_t*)out - (uint8_t*)buf;
+}
+
+void trace_reset() {
+    uint32_t cpu, i;
+    for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (i = 0; i < TRACE_RING_SIZE; i++)
+            rings[cpu].events[i].type = TRACE_EV_NONE;
+        rings[cpu].head = 0;
+    }
+    epoch_tsc = 0;
+}
+
+/* proc/trace: what each ring holds and how much it already dropped */
+void trace_info(procfs_out_t* out) {
+    uint32_t cpu, head;
+    procfs_puts(out, "categories: ");
+    if (TRACE_MASK & TRACE_SYSCALL) procfs_puts(out, "syscall ");
+    if (TRACE_MASK & TRACE_SWITCH) procfs_puts(out, "switch ");
+    if (TRACE_MASK & TRACE_IRQ) procfs_puts(out, "irq ");
+    if (TRACE_MASK & TRACE_FAULT) procfs_puts(out, "fault ");
+    if (TRACE_MASK & TRACE_PROC) procfs_puts(out, "proc ");
+    procfs_puts(out, "\nCPU  RECORDED  OVERWRITTEN\n");
+    for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+        head = rings[cpu].head;
+        procfs_putu(out, cpu, 3);
+        procfs_putu(out, head, 10);
+        procfs_putu(out, head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0, 13);
+        procfs_puts(out, "\n");
+    }
+}
@@ -0,0 +1,96 @@
+/* trace.h - Flight recorder: per-CPU rings of binary trace events
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "types.h"
+
+/* Categories, recorded when their bit is in TRACE_MASK. Build with
+ * -DTRACE_MASK=0 to compile every probe out, or with a subset. */
+#define TRACE_SYSCALL 0x01
+#define TRACE_SWITCH 0x02
+#define TRACE_IRQ 0x04
+#define TRACE_FAULT 0x08
+#define TRACE_PROC 0x10
+#define TRACE_ALL 0x1F
+
+#ifndef TRACE_MASK
+#define TRACE_MASK TRACE_ALL
+#endif
+
+/* Events per CPU, power of two. Older ones are overwritten. */
+#define TRACE_RING_SIZE 512
+
+/* Event types. Shared with tools/trace_decode.c, so only ever append. */
+#define TRACE_EV_NONE 0           /* Slot never written, or being written */
+#define TRACE_EV_SYSCALL_ENTER 1  /* arg0: call number */
+#define TRACE_EV_SYSCALL_EXIT 2   /* arg0: return value */
+#define TRACE_EV_SWITCH 3         /* arg0: pid switched from, arg1: to */
+#define TRACE_EV_IRQ 4            /* arg0: vector, arg1: cycles in handlers */
+#define TRACE_EV_PAGE_FAULT 5     /* arg0: faulting address, arg1: eip */
+#define TRACE_EV_EXECUTE 6        /* arg0: new pid, arg1: parent pid */
+#define TRACE_EV_HALT 7           /* arg0: pid, arg1: exit status */
+
+#define TRACE_MAGIC 0x31435254    /* "TRC1" */
+
+#ifndef ASM
+
+#include "driver/procfs.h"
+
+/* 20 bytes with no padding, so the host decoder reads the same layout.
+ * The TSC is split for the same reason. */
+typedef struct {
+    uint32_t tsc_lo;
+    uint32_t tsc_hi;
+    uint8_t type;
+    uint8_t cpu;
+    uint8_t pid;    /* Running when the event was recorded, 0 for none */
+    uint8_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_event_t;
+
+/* Start of a dump, followed by num_events events, oldest first per CPU.
+ * Two (tsc, PIT tick) pairs let the decoder turn cycles into time. */
+typedef struct {
+    uint32_t magic;
+    uint32_t num_events;
+    uint32_t num_cpus;
+    uint32_t tick_rate;     /* PIT ticks per second */
+    uint32_t epoch_tsc_lo, epoch_tsc_hi, epoch_ticks;
+    uint32_t dump_tsc_lo, dump_tsc_hi, dump_ticks;
+    uint32_t lost;          /* Overwritten before this dump */
+} trace_header_t;
+
+/* Appends an event to this CPU's ring. Lock free and safe from any
+ * context: the slot is claimed with one xadd, which an interrupt on the
+ * same CPU can't split. */
+void trace_record(uint8_t type, uint32_t arg0, uint32_t arg1);
+
+/* handle_syscall in syscall.S can't use the trace_event macro */
+void trace_syscall_enter(uint32_t number);
+void trace_syscall_exit(int32_t result);
+
+/* Syscall 15: copies a header and the events still in the rings to buf.
+ * Returns the bytes written, -1 if buf can't even hold the header. */
+int32_t trace_dump(void* buf, int32_t nbytes);
+
+/* Empties every ring */
+void trace_reset(void);
+
+/* proc/trace: per CPU counts, the events themselves only go out through
+ * trace_dump */
+void trace_info(procfs_out_t* out);
+
+/* The probe: folds away when category isn't in TRACE_MASK */
+#define trace_event(category, type, arg0, arg1)                                \
+    do {                                                                       \
+        if (TRACE_MASK & (category))                                           \
+            trace_record((type), (uint32_t)(arg0), (uint32_t)(arg1));          \
+    } while (0)
+
+#endif /* ASM */
+
+#endif /* _TRACE_H */
@@ -0,0 +1,23 @@
+/* tsc.h - Time stamp counter helpers used for benchmarks and instrumentation
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _TSC_H
+#define _TSC_H
+
+#include "types.h"
+
+#ifndef ASM
+
+/* Reads the 64 bit time stamp counter. Differences between two reads of
+ * a short interval fit comfortably in 32 bits, so callers usually
+ * truncate the delta before printing it. */
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif /* ASM */
+
+#endif /* _TSC_H */
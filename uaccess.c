@@ -0,0 +1,46 @@
+#include "uaccess.h"
+
+uint32_t uaccess_fixups = 0;
+
+/**
+ * Copies a NUL terminated string in from user space.
+ * INPUT: to: Kernel buffer of n bytes
+ *        from: User string
+ *        n: Most bytes to copy, the NUL included
+ * OUTPUT: Length of the string, -1 if part of it is outside user space or
+ *         not mapped, or there is no NUL within n bytes
+ * EFFECT: Goes a page at a time and stops at the page holding the NUL,
+ *         so a string at the top of a mapping doesn't fault on what
+ *         follows it.
+ */
+int32_t strncpy_from_user(int8_t* to, const int8_t* from, uint32_t n) {
+    uint32_t len = 0, chunk, i;
+    while (len < n) {
+        chunk = user_page_left(from + len);
+        if (chunk > n - len) chunk = n - len;
+        if (!user_range_ok(from + len, chunk) ||
+            __copy_user(to + len, from + len, chunk))
+            return -1;
+        for (i = 0; i < chunk; i++)
+            if (!to[len + i]) return len + i;
+        len += chunk;
+    }
+    return -1;
+}
+
+/**
+ * Looks up a faulting kernel instruction.
+ * INPUT: eip: Where the page fault happened
+ * OUTPUT: Address to resume at, 0 if the fault wasn't expected
+ * EFFECT: Counts the fixups handed out, for the tests.
+ */
+uint32_t search_ex_table(uint32_t eip) {
+    const ex_entry_t* entry;
+    for (entry = __start_ex_table; entry < __stop_ex_table; entry++) {
+        if (entry->insn == eip) {
+            uaccess_fixups++;
+            return entry->fixup;
+        }
+    }
+    return 0;
+}
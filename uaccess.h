@@ -0,0 +1,74 @@
+/* uaccess.h - Copying to and from user pointers
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _UACCESS_H
+#define _UACCESS_H
+
+#include "types.h"
+#include "shm.h"
+
+/* Everything a process can map: its program page at 128MB, then the
+ * vidmap page and the shm segments. The PCB window comes right after. */
+#define USER_SPACE_START 0x08000000
+#define USER_SPACE_END ((SHM_PDE_INDEX + 1) << 22)
+#define USER_COPY_PAGE 0x1000
+
+#ifndef ASM
+
+/* One entry per kernel instruction that may fault on a user address.
+ * The page fault handler resumes at fixup instead of halting the process.
+ * The entries live in their own ex_table section, which the linker
+ * brackets with __start_ex_table and __stop_ex_table. */
+typedef struct {
+    uint32_t insn;
+    uint32_t fixup;
+} ex_entry_t;
+
+extern const ex_entry_t __start_ex_table[], __stop_ex_table[];
+
+/* Copies n bytes without looking at the addresses; a fault on either side
+ * stops the copy. Returns the number of bytes NOT copied. For drivers,
+ * whose callers either checked the range or passed kernel memory. */
+uint32_t __copy_user(void* to, const void* from, uint32_t n);
+
+/* Returns the fixup address for a faulting eip, 0 if it isn't in the table */
+uint32_t search_ex_table(uint32_t eip);
+
+/* Faults turned into failed copies so far */
+extern uint32_t uaccess_fixups;
+
+/* 1 if [addr, addr + n) lies in user space. Only a range check: whether
+ * it is mapped is left to the fault handler. */
+static inline int32_t user_range_ok(const void* addr, uint32_t n) {
+    uint32_t start = (uint32_t)addr;
+    return start >= USER_SPACE_START && start + n <= USER_SPACE_END &&
+           start + n >= start;
+}
+
+/* Bytes from addr to the end of its 4kB page. Copying a string no
+ * further than that can't fault on a page past its NUL. */
+static inline uint32_t user_page_left(const void* addr) {
+    return USER_COPY_PAGE - ((uint32_t)addr & (USER_COPY_PAGE - 1));
+}
+
+/* Range checked copies for syscalls. Return 0, or -1 if the user range
+ * is bad or any of it isn't mapped. */
+static inline int32_t copy_from_user(void* to, const void* from, uint32_t n) {
+    if (!user_range_ok(from, n)) return -1;
+    return __copy_user(to, from, n) ? -1 : 0;
+}
+
+static inline int32_t copy_to_user(void* to, const void* from, uint32_t n) {
+    if (!user_range_ok(to, n)) return -1;
+    return __copy_user(to, from, n) ? -1 : 0;
+}
+
+/* Copies a user string, its NUL included, into n bytes of kernel buffer.
+ * Returns its length, or -1 if it isn't all in user space and mapped, or
+ * has no NUL within n bytes. */
+int32_t strncpy_from_user(int8_t* to, const int8_t* from, uint32_t n);
+
+#endif /* ASM */
+
+#endif /* _UACCESS_H */
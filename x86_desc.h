@@ -15,6 +15,9 @@
 #define USER_DS 0x002B
 #define KERNEL_TSS 0x0030
 #define KERNEL_LDT 0x0038
+/* The APs' TSSes follow the LDT, one GDT entry each */
+#define AP_TSS_BASE 0x0040
+#define AP_TSS(cpu) (AP_TSS_BASE + ((cpu) - 1) * 8)
 
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE 104
@@ -126,6 +129,8 @@ extern uint32_t ldt;
 extern uint32_t tss_size;
 extern seg_desc_t tss_desc_ptr;
 extern tss_t tss;
+/* Descriptors for AP_TSS(1) and up, filled in by smp_init */
+extern seg_desc_t ap_tss_desc_ptr[];
 
 /* Sets runtime-settable parameters in the GDT entry for the LDT */
 #define SET_LDT_PARAMS(str, addr, lim)                                         \